@@ -64,7 +64,7 @@ int main(void) {
     clock_t start = clock();
     for (uint32_t op = 0; op < NOPS; op++) {
         int r = rand() % 1000;
-        char *lookup_key = dt->primary->keys + (rand() % dt->primary->count) * dt->primary->key_size;
+        char *lookup_key = lb_keys(&dt->primary) + (rand() % dt->primary.count) * dt->primary.key_size;
         if (r < 500) { // Insert
             char* key = random_string(10);
             my_type_t value = { rand(), random_string(15) };
@@ -112,13 +112,13 @@ int main(void) {
     printf("  (Expected ideal: ~O(log log log n + log(1/DELTA)) : %.10f bits)\n", ideal_pointer_bits);
 
     printf("\nPrimary Table:\n");
-    printf("  Active slots: %u\n", dt->primary->count);
-    printf("  Slots per bucket: %u\n", dt->primary->slots_per_bucket);
-    printf("  Buckets: %u\n", dt->primary->num_buckets);
+    printf("  Active slots: %u\n", dt->primary.count);
+    printf("  Slots per bucket: %u\n", dt->primary.slots_per_bucket);
+    printf("  Buckets: %u\n", dt->primary.num_buckets);
     printf("\nSecondary Table:\n");
-    printf("  Active slots: %u\n", dt->secondary->count);
-    printf("  Slots per bucket: %u\n", dt->secondary->slots_per_bucket);
-    printf("  Buckets: %u\n", dt->secondary->num_buckets);
+    printf("  Active slots: %u\n", dt->secondary.count);
+    printf("  Slots per bucket: %u\n", dt->secondary.slots_per_bucket);
+    printf("  Buckets: %u\n", dt->secondary.num_buckets);
 
     dt_destroy(dt);
     return 0;
@@ -0,0 +1,100 @@
+/* Deletes inside a read section must never wait for readers, even once more than
+   DT_RETIRE_SLOTS slots are pinned.
+   Build: cc -O2 -I.. -o ebr_overflow ebr_overflow.c -lm -lpthread
+*/
+#define TP_DT_IMPLEMENTATION
+#include "../tp_dtable.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define N (4 * DT_RETIRE_SLOTS)
+
+static dt_t *dt;
+static int stop;
+
+static uint64_t claimed(dt_t *dt) {
+    uint64_t n = 0;
+    for (int i = 0; i < 2; i++) {
+        lb_table_t *t = i ? &dt->secondary : &dt->primary;
+        for (uint32_t w = 0; w < BITMAP_WORDS(t->max_count); w++)
+            n += __builtin_popcountll(lb_bitmap(t)[w]);
+    }
+    return n;
+}
+
+static void slow_entry(void *ctx, const void *key, void *value) {
+    (void)ctx; (void)key; (void)value;
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+}
+
+static void *scan(void *arg) {
+    (void)arg;
+    dt_for_each(dt, slow_entry, NULL);
+    return NULL;
+}
+
+int main(void) {
+    dt_config_t config = { sizeof(uint64_t), sizeof(uint64_t), 1 << 16, 1 << 16, DT_CONCURRENT, 0 };
+    dt = dt_create_ex(&config);
+    assert(dt);
+
+    /* The deleting thread is itself the reader. */
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_insert(dt, &k, &k));
+    int reader = dt_read_begin(dt);
+    uint64_t key = 3, *value = dt_find_ref(dt, &key);
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_delete(dt, &k));
+    assert(*value == 3 && dt_count(dt) == 0 && claimed(dt) == N);
+    dt_read_end(dt, reader);
+    dt_reclaim(dt);
+    assert(claimed(dt) == 0);
+
+    /* Another thread holds a read section for the whole of a long scan. */
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_insert(dt, &k, &k));
+    pthread_t thread;
+    pthread_create(&thread, NULL, scan, NULL);
+    while (!__atomic_load_n(&dt->reader_mask, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_delete(dt, &k));
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    dt_reclaim(dt);
+    assert(claimed(dt) == 0);
+
+    /* A full ring whose tail is pinned must not be overwritten when reclaim frees only
+       overflow slots. Reader a pins an overflow slot but not the ring; it leaves while
+       retire_lock is held, so only the next delete's reclaim notices, and the ring is
+       then full of slots pinned by reader b. */
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_insert(dt, &k, &k));
+    uint64_t k = 0;
+    int z = dt_read_begin(dt);
+    for (; k < DT_RETIRE_SLOTS; k++)
+        assert(dt_delete(dt, &k));
+    int a = dt_read_begin(dt);
+    assert(dt_delete(dt, &k));
+    k++;
+    dt_read_end(dt, z);
+    int b = dt_read_begin(dt);
+    for (uint64_t end = k + DT_RETIRE_SLOTS; k < end; k++)
+        assert(dt_delete(dt, &k));
+    __atomic_store_n(&dt->retire_lock, 1, __ATOMIC_RELAXED);
+    dt_read_end(dt, a);
+    spin_unlock(&dt->retire_lock);
+    for (uint64_t end = k + 10; k < end; k++) {
+        assert(dt_delete(dt, &k));
+        assert(dt->retire_head - dt->retire_tail <= DT_RETIRE_SLOTS);
+    }
+    dt_read_end(dt, b);
+    dt_reclaim(dt);
+    assert(dt_count(dt) == N - k && claimed(dt) == N - k);
+
+    dt_destroy(dt);
+    printf("ok\n");
+    return 0;
+}
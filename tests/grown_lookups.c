@@ -0,0 +1,64 @@
+/* Keys inserted before the table grew stay in their old buckets; every key-based
+   operation must still reach them, and agree with dt_upsert about which keys are present.
+   Build: cc -O2 -I.. -o grown_lookups grown_lookups.c -lm -lpthread
+*/
+#define TP_DT_IMPLEMENTATION
+#include "../tp_dtable.h"
+#include <assert.h>
+#include <stdio.h>
+
+#define N 3000
+
+static void check(dt_t *dt) {
+    static uint64_t keys[N], values[N];
+    static uint8_t found[N];
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_upsert(dt, &k, &k) == 1);
+    for (uint64_t k = 0; k < N; k++) {
+        uint64_t v = k + 1;
+        assert(dt_upsert(dt, &k, &v) == 2);
+    }
+    assert(dt_count(dt) == N);
+
+    for (uint64_t k = 0; k < N; k++) {
+        uint64_t v = 0;
+        int inserted = 1;
+        assert(dt_lookup(dt, &k, &v) && v == k + 1);
+        uint64_t *ref = dt_find_ref(dt, &k);
+        assert(ref && dt_get_or_insert(dt, &k, &v, &inserted) == ref && !inserted);
+        assert(dt_insert_unique(dt, &k, &v) == 0);
+        assert(dt_fetch_add(dt, &k, 1, &v) && v == k + 1 && *ref == k + 2);
+        keys[k] = k;
+    }
+    assert(dt_lookup_batch(dt, keys, N, values, found) == N);
+    for (uint64_t k = 0; k < N; k++)
+        assert(found[k] && values[k] == k + 2);
+    assert(dt_lookup_interleaved(dt, keys, N, values, found) == N);
+    for (uint64_t k = 0; k < N; k++)
+        assert(found[k] && values[k] == k + 2);
+
+    for (uint64_t k = 0; k < N / 2; k++)
+        assert(dt_delete(dt, &k));
+    assert(dt_delete_batch(dt, keys + N / 2, N - N / 2, found) == N - N / 2);
+    assert(dt_count(dt) == 0);
+    for (uint64_t k = 0; k < N; k++)
+        assert(!dt_lookup(dt, &k, NULL) && !dt_find_ref(dt, &k));
+}
+
+int main(void) {
+    dt_t *dt = dt_create(sizeof(uint64_t), sizeof(uint64_t));
+    assert(dt);
+    check(dt);
+    dt_destroy(dt);
+
+    dt_config_t config = { sizeof(uint64_t), sizeof(uint64_t), 1 << 16, 0, DT_CONCURRENT, 0 };
+    dt = dt_create_ex(&config);
+    assert(dt);
+    check(dt);
+    dt_reset(dt);
+    check(dt);
+    dt_destroy(dt);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,48 @@
+/* Whole-table operations called from inside a dt_parallel_for_each callback run on the
+   calling worker alone and must still cover the whole table.
+   Build: cc -O2 -I.. -o nested_jobs nested_jobs.c -lm -lpthread
+*/
+#define TP_DT_IMPLEMENTATION
+#include "../tp_dtable.h"
+#include <assert.h>
+#include <stdio.h>
+
+#define N 1000
+
+static dt_t *dt;
+static uint64_t visited, inner;
+
+static void count_entry(void *ctx, const void *key, void *value) {
+    (void)ctx; (void)key; (void)value;
+    __atomic_fetch_add(&inner, 1, __ATOMIC_RELAXED);
+}
+
+static void outer_entry(void *ctx, const void *key, void *value) {
+    (void)ctx; (void)value;
+    if (*(const uint64_t *)key % 100 == 0) {
+        assert(dt_count(dt) == N);
+        uint64_t before = __atomic_load_n(&inner, __ATOMIC_RELAXED);
+        dt_parallel_for_each(dt, count_entry, NULL);
+        assert(__atomic_load_n(&inner, __ATOMIC_RELAXED) - before >= N);
+    }
+    __atomic_fetch_add(&visited, 1, __ATOMIC_RELAXED);
+}
+
+int main(void) {
+    dt_config_t config = { sizeof(uint64_t), sizeof(uint64_t), 1 << 14, 1 << 14, DT_CONCURRENT, 4 };
+    dt = dt_create_ex(&config);
+    assert(dt && dt->workers);
+    for (uint64_t k = 0; k < N; k++)
+        assert(dt_insert(dt, &k, &k));
+    assert(dt_count(dt) == N);
+
+    for (int round = 0; round < 20; round++) {
+        visited = inner = 0;
+        dt_parallel_for_each(dt, outer_entry, NULL);
+        assert(visited == N && inner == (uint64_t)N * (N / 100));
+    }
+
+    dt_destroy(dt);
+    printf("ok\n");
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <pthread.h>
 
 /* Public API for the dereference table (dt_t).
    The implementation returns a tiny_ptr_t (fixed‐size pointer) that
@@ -10,55 +11,382 @@
 */
 typedef struct {
     uint8_t table_id; // 0 = primary, 1 = secondary; 0xFF = failure
+    uint16_t shard;   // owning shard of a dt_sharded_t (0 for a plain dt_t)
     uint32_t bucket;
     uint8_t slot;
 } tiny_ptr_t;
 
+/* lb_geometry_t is the resizable part of a load-balancing table. Both fields share one
+   64-bit word so that concurrent tables can read and publish them atomically together.
+*/
+typedef union {
+    struct {
+        uint32_t num_buckets;   // number of buckets in this load-balancing table
+        uint32_t count;         // active number of slots (always a multiple of slots_per_bucket)
+    };
+    uint64_t word;
+} lb_geometry_t;
+
 typedef struct {
-    uint32_t num_buckets;       // number of buckets in this load-balancing table
+    union {
+        struct {
+            uint32_t num_buckets;   // number of buckets in this load-balancing table
+            uint32_t count;         // active number of slots (always a multiple of slots_per_bucket)
+        };
+        uint64_t geometry;      // the two fields above as one lb_geometry_t word
+    };
     uint32_t slots_per_bucket;  // bucket capacity
     size_t key_size;            // size (in bytes) of each key
     size_t value_size;          // size (in bytes) of each value
-    uint32_t count;             // active number of slots (always a multiple of slots_per_bucket)
-    char *keys;                 // pointer to keys array (allocated to MAX_CAPACITY * key_size bytes)
-    char *values;               // pointer to values array (allocated to MAX_CAPACITY * value_size bytes)
-    uint8_t *bitmap;            // occupancy bitmap (1 bit per slot, allocated to (MAX_CAPACITY+7)/8 bytes)
+    uint32_t max_count;         // reserved number of slots (a multiple of slots_per_bucket)
+    uint32_t initial_count;     // active number of slots after create/reset
+    /* The arrays below are stored as byte offsets from this header rather than pointers,
+       so that the table is valid wherever its region is mapped (see dt_shm_create).
+       Use lb_keys() etc. to address them; an offset of 0 means the array is absent. */
+    size_t keys_off;            // keys array (max_count * key_size bytes)
+    size_t values_off;          // values array (max_count * value_size bytes)
+    size_t bitmap_off;          // occupancy bitmap: slot claimed (1 bit per slot, (max_count+63)/64 words)
+    size_t ready_off;           // published bitmap: key/value written (= bitmap_off unless DT_CONCURRENT)
+    size_t gen_off;             // per-bucket generation stamp (max_count / slots_per_bucket uint16_t entries)
+    size_t locks_off;           // DT_LOCK_STRIPES cache lines of bucket spinlocks (0 unless DT_CONCURRENT)
+    size_t seq_off;             // per-bucket sequence counter, odd mid-update (0 unless DT_CONCURRENT)
+    uint32_t flags;             // DT_* flags from the config
+    uint16_t epoch;             // current generation; a bucket whose stamp differs is treated as empty
 } lb_table_t;
 
+/* Epoch-based reclamation (DT_CONCURRENT tables only).
+   A reader that brackets its work with dt_read_begin/dt_read_end occupies one of
+   DT_MAX_READERS reader slots, stamped with the reclamation epoch it entered at. While any
+   reader is registered, a delete hides its slot at once but parks it in a ring of
+   DT_RETIRE_SLOTS retired slots, tagged with the epoch of the delete; the slot only returns
+   to the free pool once every reader that might have seen it has left. Deletes that find
+   the ring full and pinned go to an overflow list instead (linked through a side array of
+   one uint32_t per slot), so a delete never waits for a reader. The price is space: slots
+   deleted while a reader stays in its section are not reused until it leaves, so under
+   heavy delete/insert churn an insert can find its buckets full and fail meanwhile.
+*/
+#define DT_MAX_READERS 64
+#define DT_RETIRE_SLOTS 1024
+
+typedef struct {
+    uint64_t epoch;             // reclamation epoch of the delete
+    uint32_t pos;               // slot index within its table
+    uint32_t table_id;          // 0 = primary, 1 = secondary
+} dt_retired_t;
+
+/* dt_workers_t is a small pool of threads for whole-table operations (wiping on reset,
+   scans, bulk loads). A job is split into one contiguous range per worker, always the same
+   way for the same table, so results never depend on thread timing. The calling thread
+   acts as worker 0.
+*/
+#define DT_MAX_WORKERS 64
+
+typedef void (*dt_job_fn)(void *ctx, unsigned worker, unsigned num_workers);
+typedef void (*dt_entry_fn)(void *ctx, const void *key, void *value);
+
+typedef struct dt_workers_t {
+    unsigned num_workers;       // including the calling thread
+    int busy;                   // a job is running (guarded by lock)
+    pthread_mutex_t lock;
+    pthread_cond_t idle;        // signalled when busy is cleared
+    pthread_cond_t wake;        // signalled when a new round starts (or on shutdown)
+    pthread_cond_t done;        // signalled when the last helper finishes a round
+    uint64_t round;             // incremented for every job
+    unsigned pending;           // helpers still running the current round
+    unsigned started;           // next worker index to hand to a starting helper
+    int stop;
+    dt_job_fn fn;
+    void *ctx;
+    pthread_t threads[DT_MAX_WORKERS];
+} dt_workers_t;
+
 /* dt_t holds two load-balancing tables:
    - primary: designed for high load factor (approximately 1 - Θ(δ²))
    - secondary: sparser (e.g. load factor ≈ 1 - Θ(1/ log log n))
+   Both headers are embedded, and every array they point to is carved out of the same
+   region, which starts with the dt_t itself.
 */
 typedef struct dt_t {
-    lb_table_t *primary;
-    lb_table_t *secondary;
+    lb_table_t primary;
+    lb_table_t secondary;
+    void *base;                 // free-list link while parked in a dt_pool_t
+    size_t size;                // size of the mapping at this header; 0 if the caller owns the memory
+    size_t readers_off;         // reader epochs, a cache line each, 0 = unstamped (0 unless DT_CONCURRENT)
+    size_t retired_off;         // ring of deleted slots awaiting reclamation (DT_RETIRE_SLOTS entries)
+    size_t overflow_off;        // retire overflow links, one uint32_t per slot of both tables
+    uint32_t magic;             // DT_MAGIC once a shared table is fully built
+    uint64_t reader_mask;       // bit i set while reader slot i is in use
+    uint64_t read_epoch;        // reclamation epoch, advanced by every deferred delete (starts at 1)
+    uint32_t retire_lock;       // guards the ring
+    uint32_t retire_head;       // next ring entry to fill
+    uint32_t retire_tail;       // oldest ring entry still retired
+    uint32_t overflow_open;     // overflow list still being added to (slot index + 1; 0 = empty)
+    uint32_t overflow_sealed;   // overflow list waiting for sealed_epoch to pass
+    uint64_t open_epoch;        // epoch of the newest delete on the open list
+    uint64_t sealed_epoch;      // epoch of the newest delete on the sealed list
+    dt_workers_t *workers;      // threads for whole-table operations (process-local; NULL = caller only)
 } dt_t;
 
+/* dt_config_t describes a table for dt_create_ex/dt_init_in.
+   Zero-valued capacities fall back to MAX_CAPACITY and INITIAL_CAPACITY.
+   num_workers > 1 gives a table from dt_create_ex its own dt_workers_t of that many threads
+   (the caller included) for whole-table operations; other constructors ignore it.
+   Flags:
+   - DT_CONCURRENT: dt_insert/dt_lookup/dt_delete may be called from many threads at once.
+     Inserts claim slots lock-free; lookups are lock-free and validate against a per-bucket
+     sequence counter; deletes take a striped bucket spinlock; growth is a single CAS on the
+     table geometry and blocks nobody. Readers that hold on to value pointers use
+     dt_read_begin/dt_read_end, which defer slot reuse by deletes until they leave.
+     dt_reset and dt_destroy must not overlap other operations.
+*/
+#define DT_CONCURRENT 0x1
+
+typedef struct {
+    size_t key_size;
+    size_t value_size;
+    uint32_t max_capacity;      // slots reserved per table
+    uint32_t initial_capacity;  // active slots per table after create/reset
+    uint32_t flags;             // DT_* flags
+    uint32_t num_workers;       // threads for whole-table operations (0 or 1 = caller only)
+} dt_config_t;
+
+/* dt_ingest_t funnels inserts and deletes from many producer threads into one applier.
+   Each producer owns a single-producer/single-consumer ring of DT_INGEST_RING operations
+   (lock-free: one release store per push or drain). The applier, always the same thread,
+   calls dt_ingest_drain to empty the rings in batches of up to DT_INGEST_BATCH and applies
+   each run of inserts or deletes with dt_insert_batch/dt_delete_batch, which group it by
+   bucket. The table then only ever has one writer; it needs DT_CONCURRENT only if other
+   threads read it meanwhile.
+   An operation may carry a completion callback, run on the applier thread with the result
+   (1 = inserted / deleted, 0 = table full / key absent). dt_future_done completes a
+   zero-initialised dt_future_t, which the producer can dt_future_wait on.
+*/
+#ifndef DT_INGEST_RING
+#define DT_INGEST_RING 1024 // operations per producer ring (a power of two)
+#endif
+#ifndef DT_INGEST_BATCH
+#define DT_INGEST_BATCH 256 // operations staged per dt_insert_batch/dt_delete_batch call
+#endif
+
+typedef void (*dt_done_fn)(void *ctx, int result);
+
+typedef struct {
+    dt_done_fn done;            // completion callback (NULL = none)
+    void *ctx;                  // its argument
+    uint32_t op;                // DT_INGEST_INSERT or DT_INGEST_DELETE
+} dt_ingest_op_t;
+
+typedef struct {
+    _Alignas(64) uint64_t head; // next entry the producer fills
+    uint64_t tail_cache;        // the producer's last view of tail
+    char *entries;              // DT_INGEST_RING entries: dt_ingest_op_t, key, value
+    _Alignas(64) uint64_t tail; // next entry the applier takes
+} dt_ring_t;
+
+typedef struct {
+    dt_t *dt;
+    uint32_t num_producers;
+    uint32_t entry_size;        // bytes per ring entry
+    size_t size;                // bytes mapped for the queue, its rings and staging
+    char *keys;                 // staging for one batch: keys,
+    char *values;               // values,
+    dt_ingest_op_t *staged;     // callbacks
+    uint8_t *ok;                // and results
+    dt_ring_t rings[];
+} dt_ingest_t;
+
+typedef struct {
+    int result;                 // the operation's result, once ready
+    int ready;                  // set by dt_future_done
+} dt_future_t;
+
+/* dt_pool_t hands out small tables from one large reservation.
+   Each size class holds tables of DT_POOL_MIN_CAPACITY << class reserved slots;
+   returned tables are kept on a per-class free list and reused without touching the kernel.
+*/
+#define DT_POOL_CLASSES 8
+#define DT_POOL_MIN_CAPACITY 256
+
+typedef struct dt_pool_t {
+    dt_config_t config;                         // key/value sizes and initial capacity for every table
+    char *base;                                 // start of the reservation (the pool header lives here)
+    size_t size;                                // size of the reservation
+    size_t used;                                // bytes handed out so far (bump offset from base)
+    uint32_t class_slots[DT_POOL_CLASSES];      // primary max_count of a table in each class
+    size_t class_bytes[DT_POOL_CLASSES];        // footprint of a table in each class
+    dt_t *free_list[DT_POOL_CLASSES];           // parked tables, linked through dt_t.base
+} dt_pool_t;
+
+/* NUMA placement.
+   dt_set_placement applies a memory policy to some of a table's regions (DT_REGION_*).
+   The policy values match the kernel's MPOL_* constants; nodemask selects the nodes
+   (one bit per node) for DT_NUMA_BIND and DT_NUMA_INTERLEAVE and is ignored for DT_NUMA_DEFAULT.
+*/
+#define DT_REGION_KEYS   0x1
+#define DT_REGION_VALUES 0x2
+#define DT_REGION_BITMAP 0x4
+#define DT_REGION_ALL    (DT_REGION_KEYS | DT_REGION_VALUES | DT_REGION_BITMAP)
+
+#define DT_NUMA_DEFAULT    0
+#define DT_NUMA_BIND       2
+#define DT_NUMA_INTERLEAVE 3
+
+/* dt_replicated_t keeps one full replica of a table per NUMA node, each bound to its node.
+   Writes are applied to every replica; lookups read the replica of the caller's node.
+*/
+#define DT_MAX_NODES 8
+
+typedef struct {
+    int num_nodes;
+    dt_t *replica[DT_MAX_NODES];
+} dt_replicated_t;
+
+/* dt_sharded_t splits keys over 1 << shard_bits independent tables, routed by the high bits
+   of a separate hash. Each shard grows on its own and is guarded by its own spinlock (or,
+   for DT_CONCURRENT shards, by the shard's own concurrency control). Callers that prefer
+   an owner thread per shard can route with dt_sharded_shard and use shards[i].dt directly.
+*/
+#define DT_MAX_SHARD_BITS 12
+
+typedef struct {
+    _Alignas(64) uint32_t lock; // serialises operations on a non-concurrent shard
+    dt_t *dt;
+} dt_shard_t;
+
+typedef struct {
+    uint32_t shard_bits;
+    uint32_t num_shards;
+    size_t key_size;
+    size_t size;                // bytes mapped for this header and the shard array
+    dt_shard_t shards[];
+} dt_sharded_t;
+
+/* dt_thread_t is optional per-thread insertion state for concurrent tables.
+   For each table it remembers, in a small direct-mapped cache keyed by bucket, which bitmap
+   word of the bucket last had a free slot, and it staggers where threads without a hint
+   start scanning. Threads inserting into the same popular buckets then CAS different words
+   instead of all fighting over the first one. Initialise with dt_thread_init; never share
+   one between threads.
+*/
+#define DT_HINT_SLOTS 16
+
+typedef struct {
+    uint32_t bucket;            // bucket + 1 this hint is for (0 = empty)
+    uint32_t word;              // word offset within the bucket where a free slot was last claimed
+} dt_hint_t;
+
+typedef struct {
+    uint32_t salt;              // starting word offset for buckets without a hint
+    dt_hint_t hints[2][DT_HINT_SLOTS]; // per table (primary, secondary)
+} dt_thread_t;
+
 /* Public functions */
 dt_t *dt_create(size_t key_size, size_t value_size);
+dt_t *dt_create_ex(const dt_config_t *config);
+size_t dt_footprint(const dt_config_t *config);
+dt_t *dt_init_in(void *buffer, size_t size, const dt_config_t *config);
 void dt_destroy(dt_t *dt);
 
 int dt_insert(dt_t *dt, const void *key, const void *value);
+int dt_insert_tp(dt_t *dt, const void *key, const void *value, tiny_ptr_t *tp_out);
+void *dt_deref(dt_t *dt, tiny_ptr_t tp);
+void dt_thread_init(dt_thread_t *ts, uint32_t thread_id);
+int dt_insert_hinted(dt_t *dt, dt_thread_t *ts, const void *key, const void *value);
 int dt_lookup(dt_t *dt, const void *key, void *value_out);
+void *dt_find_ref(dt_t *dt, const void *key);
+void *dt_alloc(dt_t *dt, const void *key);
+void dt_commit(dt_t *dt, void *value);
+int dt_cas(dt_t *dt, const void *key, uint64_t *expected, uint64_t desired);
+uint32_t dt_hash(const dt_t *dt, const void *key);
+void dt_prefetch(dt_t *dt, const void *key, int with_value);
+void dt_prefetch_hashed(dt_t *dt, uint32_t hash, int with_value);
+int dt_fetch_add(dt_t *dt, const void *key, uint64_t delta, uint64_t *old_out);
+size_t dt_lookup_batch(dt_t *dt, const void *keys, size_t n, void *values_out, uint8_t *found_out);
+size_t dt_lookup_interleaved(dt_t *dt, const void *keys, size_t n, void *values_out, uint8_t *found_out);
+size_t dt_insert_batch(dt_t *dt, const void *keys, const void *values, size_t n, uint8_t *ok_out);
+size_t dt_delete_batch(dt_t *dt, const void *keys, size_t n, uint8_t *found_out);
 int dt_delete(dt_t *dt, const void *key);
+int dt_take(dt_t *dt, const void *key, void *value_out);
+size_t dt_take_batch(dt_t *dt, const void *keys, size_t n, void *values_out, uint8_t *found_out);
+int dt_upsert(dt_t *dt, const void *key, const void *value);
+void *dt_get_or_insert(dt_t *dt, const void *key, const void *value, int *inserted_out);
+int dt_insert_unique(dt_t *dt, const void *key, const void *value);
 void dt_reset(dt_t *dt);
+int dt_read_begin(dt_t *dt);
+void dt_read_end(dt_t *dt, int reader);
+uint32_t dt_reclaim(dt_t *dt);
+uint64_t dt_count(dt_t *dt);
+size_t dt_build(dt_t *dt, const void *keys, const void *values, size_t n);
+void dt_for_each(dt_t *dt, dt_entry_fn fn, void *ctx);
+void dt_parallel_for_each(dt_t *dt, dt_entry_fn fn, void *ctx);
+
+dt_workers_t *dt_workers_create(unsigned num_workers);
+void dt_workers_destroy(dt_workers_t *w);
+unsigned dt_workers_run(dt_workers_t *w, dt_job_fn fn, void *ctx);
+
+dt_ingest_t *dt_ingest_create(dt_t *dt, uint32_t num_producers);
+void dt_ingest_destroy(dt_ingest_t *q);
+int dt_ingest_insert(dt_ingest_t *q, uint32_t producer, const void *key, const void *value,
+                     dt_done_fn done, void *ctx);
+int dt_ingest_delete(dt_ingest_t *q, uint32_t producer, const void *key, dt_done_fn done, void *ctx);
+size_t dt_ingest_drain(dt_ingest_t *q);
+void dt_future_done(void *ctx, int result);
+int dt_future_wait(dt_future_t *f);
+
+dt_pool_t *dt_pool_create(const dt_config_t *config, size_t reserve);
+void dt_pool_destroy(dt_pool_t *pool);
+dt_t *dt_pool_get(dt_pool_t *pool, uint32_t capacity);
+void dt_pool_put(dt_pool_t *pool, dt_t *dt);
+
+int dt_set_placement(dt_t *dt, unsigned regions, int policy, unsigned long nodemask);
+dt_replicated_t *dt_replicated_create(const dt_config_t *config, int num_nodes);
+void dt_replicated_destroy(dt_replicated_t *r);
+int dt_replicated_insert(dt_replicated_t *r, const void *key, const void *value);
+int dt_replicated_lookup(dt_replicated_t *r, const void *key, void *value_out);
+int dt_replicated_delete(dt_replicated_t *r, const void *key);
+void dt_replicated_reset(dt_replicated_t *r);
+
+dt_sharded_t *dt_sharded_create(const dt_config_t *config, unsigned shard_bits);
+void dt_sharded_destroy(dt_sharded_t *s);
+uint32_t dt_sharded_shard(const dt_sharded_t *s, const void *key);
+int dt_sharded_insert(dt_sharded_t *s, const void *key, const void *value, tiny_ptr_t *tp_out);
+int dt_sharded_lookup(dt_sharded_t *s, const void *key, void *value_out);
+int dt_sharded_delete(dt_sharded_t *s, const void *key);
+void dt_sharded_reset(dt_sharded_t *s);
+void *dt_sharded_deref(dt_sharded_t *s, tiny_ptr_t tp);
+
+dt_t *dt_shm_create(const char *name, const dt_config_t *config);
+dt_t *dt_shm_attach(const char *name);
+int dt_shm_unlink(const char *name);
+dt_t *dt_memfd_create(const char *name, const dt_config_t *config, int *fd_out);
+dt_t *dt_fd_attach(int fd);
 
 #endif /* TP_DT_H */
 
 #ifdef TP_DT_IMPLEMENTATION
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <math.h>
 
 /* Configuration macros.
-   - MAX_CAPACITY: the maximum number of slots allocated (fixed, via mmap)
-   - INITIAL_CAPACITY: the starting active capacity (in slots)
+   - MAX_CAPACITY: the default maximum number of slots reserved per table
+   - INITIAL_CAPACITY: the default starting active capacity (in slots)
    - DELTA: parameter controlling sparsity; here we set it as 1 / log(log(MAX_CAPACITY))
      (guarded to be nonzero via fmax)
    - PRIMARY_BUCKET_SIZE: chosen as Θ(δ⁻² log(1/δ))
    - SECONDARY_BUCKET_SIZE: chosen as at least 1 (using fmax) and roughly log₂(log₂(MAX_CAPACITY))
+   - DT_PREFETCH_GROUP: how many keys the batch operations hash and prefetch before probing
+     or placing them (define before including this file to tune; default 16)
+   - DT_INFLIGHT: how many lookups dt_lookup_interleaved keeps in flight (default 8)
+   - DT_WIPE_ON_DELETE: if defined before including this file, dt_delete zeroes the key and
+     value of the removed slot (a retired slot, see dt_read_begin, when it is reclaimed) and
+     dt_reset zeroes the active key/value ranges. By default
+     only occupancy metadata is touched and stale bytes stay behind until overwritten.
 */
 #define MAX_CAPACITY (1 << 20)
 #define INITIAL_CAPACITY (64)
@@ -66,6 +394,19 @@ void dt_reset(dt_t *dt);
 #define DELTA (1.0 / (fmax(SAFE_LOG(SAFE_LOG(MAX_CAPACITY)), 1.0)))
 #define PRIMARY_BUCKET_SIZE ((uint32_t)fmax(4, 16 * (1.0 / (DELTA * DELTA)) * fmax(log(1.0 / DELTA), 1.0)))
 #define SECONDARY_BUCKET_SIZE ((uint32_t)fmax(2, log2(fmax(log2(MAX_CAPACITY), 2.0))))
+#define DT_ALIGN 64
+#define DT_LOCK_STRIPES 64
+#define PRIMARY_SEED 0xABCDEF01
+#define SECONDARY_SEED 0x12345678
+#define SHARD_SEED 0x9E3779B9
+#define DT_MAGIC 0x54504454 // "TPDT"
+#define DT_CHUNK_SLOTS 4096 // slots per unit of work in dt_parallel_for_each
+#ifndef DT_PREFETCH_GROUP
+#define DT_PREFETCH_GROUP 16 // keys hashed and prefetched ahead of probing in the batch operations
+#endif
+#ifndef DT_INFLIGHT
+#define DT_INFLIGHT 8 // lookups kept in flight at once by dt_lookup_interleaved
+#endif
 
 /*-------------------------------------------------------------------------
    Internal Structures and Utility Functions
@@ -90,196 +431,2463 @@ static inline void *xmap(size_t size) {
     return (p == MAP_FAILED) ? NULL : p;
 }
 
-/* Bitmap helper macros (1 bit per slot) */
-#define BITMAP_TEST(bitmap, idx)   ((bitmap[(idx) / 8] >> ((idx) % 8)) & 1)
-#define BITMAP_SET(bitmap, idx)    (bitmap[(idx) / 8] |= (1 << ((idx) % 8)))
-#define BITMAP_CLEAR(bitmap, idx)  (bitmap[(idx) / 8] &= ~(1 << ((idx) % 8)))
+/* Bitmap helper macros (1 bit per slot, 64 slots per word).
+   BITMAP_TEST loads with acquire ordering so that a reader seeing a published bit also
+   sees the key and value written before it was set.
+*/
+#define BITMAP_TEST(bitmap, idx) \
+    ((__atomic_load_n(&(bitmap)[(idx) / 64], __ATOMIC_ACQUIRE) >> ((idx) % 64)) & 1)
+#define BITMAP_SET(bitmap, idx)    ((bitmap)[(idx) / 64] |= (1ULL << ((idx) % 64)))
+#define BITMAP_CLEAR(bitmap, idx)  ((bitmap)[(idx) / 64] &= ~(1ULL << ((idx) % 64)))
+#define BITMAP_WORDS(n)            (((size_t)(n) + 63) / 64)
+
+/* bitmap_mask returns the bits of word w that fall inside slots [start, end). */
+static inline uint64_t bitmap_mask(uint32_t w, uint32_t start, uint32_t end) {
+    uint32_t lo = start > w * 64 ? start - w * 64 : 0;
+    uint32_t hi = end < (w + 1) * 64 ? end - w * 64 : 64;
+    return (hi - lo == 64 ? ~0ULL : ((1ULL << (hi - lo)) - 1)) << lo;
+}
+
+/* bitmap_clear_range clears bits [start, start + n). The partial words at either end may be
+   shared with a neighbouring bucket, and lock-free readers may be scanning any of them, so in
+   concurrent tables every word is updated atomically.
+*/
+static inline void bitmap_clear_range(uint64_t *bitmap, uint32_t start, uint32_t n, int atomic) {
+    uint32_t end = start + n;
+    for (uint32_t w = start / 64; w * 64 < end; w++) {
+        uint64_t mask = bitmap_mask(w, start, end);
+        if (!atomic)
+            bitmap[w] &= ~mask;
+        else if (mask == ~0ULL)
+            __atomic_store_n(&bitmap[w], 0, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_and(&bitmap[w], ~mask, __ATOMIC_RELAXED);
+    }
+}
+
+/* bitmap_set_range sets n bits from start with atomic ORs (release), so that writers of
+   neighbouring ranges that share a boundary word do not lose each other's bits.
+*/
+static inline void bitmap_set_range(uint64_t *bitmap, uint32_t start, uint32_t n) {
+    uint32_t end = start + n;
+    for (uint32_t w = start / 64; w * 64 < end; w++)
+        __atomic_fetch_or(&bitmap[w], bitmap_mask(w, start, end), __ATOMIC_RELEASE);
+}
+
+/* Spinlocks for striped bucket locking. A lock is a single uint32_t (0 = free). */
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+static inline void spin_lock(uint32_t *l) {
+    while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(l, __ATOMIC_RELAXED))
+            CPU_RELAX();
+}
+
+static inline void spin_unlock(uint32_t *l) {
+    __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
 
 /*-------------------------------------------------------------------------
    Load-Balancing Table (lb_table_t) Functions
 -------------------------------------------------------------------------*/
 
-/* lb_create allocates a new load-balancing table.
-   Note: the keys, values, and bitmap arrays are allocated with MAX_CAPACITY size
-   (so that future dynamic growth only adjusts t->count).
-   This design ensures that already allocated tiny pointers remain valid.
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+#define LB_MAX_BUCKETS(t) ((t)->max_count / (t)->slots_per_bucket)
+
+/* Array accessors: turn the offsets kept in the headers into addresses in this process. */
+#define LB_ARRAY(t, off, type) ((off) ? (type *)((char *)(t) + (off)) : NULL)
+
+static inline char *lb_keys(const lb_table_t *t) { return LB_ARRAY(t, t->keys_off, char); }
+static inline char *lb_values(const lb_table_t *t) { return LB_ARRAY(t, t->values_off, char); }
+static inline uint64_t *lb_bitmap(const lb_table_t *t) { return LB_ARRAY(t, t->bitmap_off, uint64_t); }
+static inline uint64_t *lb_ready(const lb_table_t *t) { return LB_ARRAY(t, t->ready_off, uint64_t); }
+static inline uint16_t *lb_gen(const lb_table_t *t) { return LB_ARRAY(t, t->gen_off, uint16_t); }
+static inline uint32_t *lb_locks(const lb_table_t *t) { return LB_ARRAY(t, t->locks_off, uint32_t); }
+static inline uint32_t *lb_seq(const lb_table_t *t) { return LB_ARRAY(t, t->seq_off, uint32_t); }
+static inline uint64_t *dt_readers(const dt_t *dt) { return LB_ARRAY(dt, dt->readers_off, uint64_t); }
+static inline dt_retired_t *dt_retired(const dt_t *dt) { return LB_ARRAY(dt, dt->retired_off, dt_retired_t); }
+static inline uint32_t *dt_overflow(const dt_t *dt) { return LB_ARRAY(dt, dt->overflow_off, uint32_t); }
+
+/* lb_init fills in the geometry of a load-balancing table; no memory is attached yet.
+   The reservation is rounded up to whole buckets (and at least one bucket), and the
+   initial capacity is clamped to it.
 */
-static lb_table_t *lb_create(size_t key_size, size_t value_size,
-                             uint32_t slots_per_bucket, uint32_t initial_capacity) {
-    lb_table_t *t = xmap(sizeof(lb_table_t));
+static void lb_init(lb_table_t *t, const dt_config_t *cfg, uint32_t slots_per_bucket) {
+    uint32_t max_count = cfg->max_capacity ? cfg->max_capacity : MAX_CAPACITY;
+    uint32_t initial = cfg->initial_capacity ? cfg->initial_capacity : INITIAL_CAPACITY;
+    memset(t, 0, sizeof(*t));
     t->slots_per_bucket = slots_per_bucket;
-    t->num_buckets = fmax(1, initial_capacity / slots_per_bucket);
-    t->key_size = key_size;
-    t->value_size = value_size;
-    t->count = initial_capacity;
-    t->keys = xmap(MAX_CAPACITY * key_size);
-    t->values = xmap(MAX_CAPACITY * value_size);
-    t->bitmap = xmap((MAX_CAPACITY + 7) / 8);
-    return t;
-}
-
-/* lb_grow doubles the active capacity of the table, up to MAX_CAPACITY.
-   (Since memory was allocated for MAX_CAPACITY, we simply update count.)
-   This dynamic increase allows the table to absorb more allocations without rehashing old entries.
+    t->key_size = cfg->key_size;
+    t->value_size = cfg->value_size;
+    t->max_count = (max_count + slots_per_bucket - 1) / slots_per_bucket * slots_per_bucket;
+    t->initial_count = initial < t->max_count ? initial : t->max_count;
+    t->count = t->initial_count;
+    t->num_buckets = fmax(1, t->count / slots_per_bucket);
+    t->flags = cfg->flags;
+    t->epoch = 1;
+}
+
+/* lb_carve lays out the keys, values, bitmap, stamp and (for DT_CONCURRENT) ready,
+   sequence and lock arrays of t starting at offset off from base, each aligned to
+   DT_ALIGN, and returns the offset just past them. With base == NULL it only measures.
+   Note: the arrays are sized for max_count slots up front (so that future dynamic growth
+   only adjusts t->count). This design ensures that already allocated tiny pointers
+   remain valid.
 */
-static int lb_grow(lb_table_t *t) {
-    if (t->count >= MAX_CAPACITY) return 0;
-    t->count *= 2;
-    if (t->count > MAX_CAPACITY)
-        t->count = MAX_CAPACITY;
-    t->num_buckets = t->count / t->slots_per_bucket;
-    return 1;
+static size_t lb_carve(lb_table_t *t, char *base, size_t off) {
+    size_t keys = ALIGN_UP(off, DT_ALIGN);
+    size_t values = ALIGN_UP(keys + (size_t)t->max_count * t->key_size, DT_ALIGN);
+    size_t bitmap = ALIGN_UP(values + (size_t)t->max_count * t->value_size, DT_ALIGN);
+    size_t bitmap_bytes = BITMAP_WORDS(t->max_count) * sizeof(uint64_t);
+    int concurrent = (t->flags & DT_CONCURRENT) != 0;
+    size_t ready = ALIGN_UP(bitmap + bitmap_bytes, DT_ALIGN);
+    size_t gen = concurrent ? ALIGN_UP(ready + bitmap_bytes, DT_ALIGN) : ready;
+    size_t seq = ALIGN_UP(gen + (size_t)LB_MAX_BUCKETS(t) * sizeof(uint16_t), DT_ALIGN);
+    size_t locks = concurrent ? ALIGN_UP(seq + (size_t)LB_MAX_BUCKETS(t) * sizeof(uint32_t), DT_ALIGN) : seq;
+    size_t end = locks + (concurrent ? DT_LOCK_STRIPES * DT_ALIGN : 0);
+    if (base) {
+        size_t self = (char *)t - base;
+        t->keys_off = keys - self;
+        t->values_off = values - self;
+        t->bitmap_off = bitmap - self;
+        t->ready_off = concurrent ? ready - self : t->bitmap_off;
+        t->gen_off = gen - self;
+        t->seq_off = concurrent ? seq - self : 0;
+        t->locks_off = concurrent ? locks - self : 0;
+    }
+    return end;
 }
 
-/* lb_insert attempts to insert a key/value pair into table t.
-   It hashes the key with the provided seed, chooses a bucket, and then linearly scans the bucket.
-   Returns 1 if insertion succeeds (and outputs bucket and slot used via pointers),
-   or 0 if the entire bucket is full (in which case the caller may attempt to grow t).
+/* Striped bucket locks.
+   Bucket b is guarded by stripe b % DT_LOCK_STRIPES, each stripe on its own cache line.
+   Deletes and lazy bucket re-initialisation take the stripe; inserts (which claim slots
+   with CAS, see lb_claim) and lookups (see lb_lookup) do not.
+   Only dt_reset takes every stripe of a table. Key-based writers lock the stripes of the
+   key's buckets under one snapshot of the geometry (see lb_lock_key); a concurrent resize
+   does not invalidate them, since every bucket of an older geometry is still backed by
+   reserved memory.
+   For tables without DT_CONCURRENT all of these are no-ops.
 */
-static int lb_insert(lb_table_t *t, const void *key, const void *value,
-                     uint32_t seed, uint32_t *bucket_out, uint8_t *slot_out) {
-    uint32_t bucket = hash_key(key, t->key_size, seed) % t->num_buckets;
-    uint32_t base = bucket * t->slots_per_bucket;
-    for (uint32_t i = 0; i < t->slots_per_bucket; i++) {
-        uint32_t pos = base + i;
-        if (!BITMAP_TEST(t->bitmap, pos)) {
-            BITMAP_SET(t->bitmap, pos);
-            memcpy(t->keys + pos * t->key_size, key, t->key_size);
-            memcpy(t->values + pos * t->value_size, value, t->value_size);
-            *bucket_out = bucket;
-            *slot_out = (uint8_t)i;
+#define LB_STRIPE(t, bucket) (&lb_locks(t)[((bucket) % DT_LOCK_STRIPES) * (DT_ALIGN / sizeof(uint32_t))])
+
+/* lb_geometry takes one consistent snapshot of count and num_buckets. */
+static inline lb_geometry_t lb_geometry(lb_table_t *t) {
+    lb_geometry_t g;
+    g.word = __atomic_load_n(&t->geometry, __ATOMIC_ACQUIRE);
+    return g;
+}
+
+static inline void lb_unlock_bucket(lb_table_t *t, uint32_t bucket) {
+    if (t->locks_off) spin_unlock(LB_STRIPE(t, bucket));
+}
+
+static void lb_lock_all(lb_table_t *t) {
+    if (!t->locks_off) return;
+    for (uint32_t i = 0; i < DT_LOCK_STRIPES; i++)
+        spin_lock(LB_STRIPE(t, i));
+}
+
+static void lb_unlock_all(lb_table_t *t) {
+    if (!t->locks_off) return;
+    for (uint32_t i = DT_LOCK_STRIPES; i-- > 0;)
+        spin_unlock(LB_STRIPE(t, i));
+}
+
+/* lb_grow doubles the active capacity of the table, up to max_count.
+   (Since memory was reserved for max_count, we simply update count.)
+   This dynamic increase allows the table to absorb more allocations without rehashing old entries.
+   seen is the count the caller observed before its insert failed. In concurrent tables the
+   threads that hit a full bucket race to CAS the geometry from seen to its doubled value;
+   one wins, and the rest find the geometry already moved on and simply retry their insert.
+   Every operation works from a single geometry snapshot, so each sees either the old or
+   the new geometry, never a mix, and nobody waits for the resize.
+*/
+static int lb_grow(lb_table_t *t, uint32_t seen) {
+    lb_geometry_t g = lb_geometry(t);
+    while (g.count == seen) {
+        if (g.count >= t->max_count) return 0;
+        lb_geometry_t next;
+        next.count = g.count * 2 > t->max_count ? t->max_count : g.count * 2;
+        next.num_buckets = fmax(1, next.count / t->slots_per_bucket);
+        if (!t->locks_off) {
+            t->geometry = next.word;
             return 1;
         }
+        if (__atomic_compare_exchange_n(&t->geometry, &g.word, next.word, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            return 1;
     }
-    return 0; // Insertion fails if bucket is full
+    return 1; // someone else grew the table first
 }
 
-/*-------------------------------------------------------------------------
-   Dereference Table (dt_t) Functions
--------------------------------------------------------------------------*/
+/* lb_reserve grows t in one step to the smallest doubling of its active capacity that
+   holds at least slots (capped at max_count), with the same single CAS as lb_grow.
+*/
+static void lb_reserve(lb_table_t *t, uint64_t slots) {
+    lb_geometry_t g = lb_geometry(t);
+    while (g.count < slots && g.count < t->max_count) {
+        lb_geometry_t next;
+        next.count = g.count;
+        while (next.count < slots && next.count < t->max_count)
+            next.count = next.count * 2 > t->max_count ? t->max_count : next.count * 2;
+        next.num_buckets = fmax(1, next.count / t->slots_per_bucket);
+        if (!t->locks_off) {
+            t->geometry = next.word;
+            return;
+        }
+        if (__atomic_compare_exchange_n(&t->geometry, &g.word, next.word, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            return;
+    }
+}
 
-/* dt_create allocates two load-balancing tables:
-   - primary: uses PRIMARY_BUCKET_SIZE and starts at INITIAL_CAPACITY slots.
-   - secondary: uses SECONDARY_BUCKET_SIZE and also starts at INITIAL_CAPACITY.
-   (In a full implementation for variable-length tiny pointers, the value array could use zone aggregation.
-    Here, we use fixed-size tiny pointers, but dynamic resizing via doubling is supported.)
+/* Per-bucket sequence counters (seqlock protocol).
+   A writer holding the bucket's stripe brackets every change that can hide or recycle a
+   slot (delete, lazy re-initialisation) with lb_write_begin/lb_write_end, which move the
+   counter to odd and back to even. A reader samples the counter before and after its probe
+   and retries if it was odd or changed. Inserts only ever publish fully written slots, so
+   they need not bump the counter.
 */
-dt_t *dt_create(size_t key_size, size_t value_size) {
-    dt_t *dt = xmap(sizeof(dt_t));
-    dt->primary = lb_create(key_size, value_size, PRIMARY_BUCKET_SIZE, INITIAL_CAPACITY);
-    dt->secondary = lb_create(key_size, value_size, SECONDARY_BUCKET_SIZE, INITIAL_CAPACITY);
-    return dt;
+static inline void lb_write_begin(lb_table_t *t, uint32_t bucket) {
+    if (!t->seq_off) return;
+    __atomic_store_n(&lb_seq(t)[bucket], lb_seq(t)[bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void lb_write_end(lb_table_t *t, uint32_t bucket) {
+    if (!t->seq_off) return;
+    __atomic_store_n(&lb_seq(t)[bucket], lb_seq(t)[bucket] + 1, __ATOMIC_RELEASE);
 }
 
-/* dt_destroy frees all memory using munmap.
-   (Since all allocations are from mmap, we unmap them here.)
+/* Generation stamps.
+   A bucket is live only while its stamp matches t->epoch; otherwise its bitmap bits are
+   leftovers from before the last reset and the bucket is considered empty. lb_touch brings
+   a stale bucket up to date by clearing its occupancy bits, so that the cost of a reset is
+   paid lazily, one bucket at a time, by the first insert that lands there.
+   In concurrent tables the stamp is published with release ordering after the bits are
+   cleared, so a lock-free inserter that sees a live stamp also sees a clean bucket.
 */
-void dt_destroy(dt_t *dt) {
-    munmap(dt->primary->keys, MAX_CAPACITY * dt->primary->key_size);
-    munmap(dt->primary->values, MAX_CAPACITY * dt->primary->value_size);
-    munmap(dt->primary->bitmap, (MAX_CAPACITY + 7) / 8);
-    munmap(dt->primary, sizeof(lb_table_t));
-    munmap(dt->secondary->keys, MAX_CAPACITY * dt->secondary->key_size);
-    munmap(dt->secondary->values, MAX_CAPACITY * dt->secondary->value_size);
-    munmap(dt->secondary->bitmap, (MAX_CAPACITY + 7) / 8);
-    munmap(dt->secondary, sizeof(lb_table_t));
-    munmap(dt, sizeof(dt_t));
-}
-
-/* dt_insert first attempts to insert into the primary table.
-   If insertion fails (bucket full), then it tries to grow the primary table.
-   If still failing, it attempts insertion (and growth) in the secondary table.
-   The returned tiny_ptr_t encodes which table was used plus the bucket and slot.
-   (In a more elaborate design, one could incorporate zone-aggregated storage for variable-length pointers.)
+#define BUCKET_LIVE(t, bucket) \
+    (__atomic_load_n(&lb_gen(t)[bucket], __ATOMIC_ACQUIRE) == __atomic_load_n(&(t)->epoch, __ATOMIC_RELAXED))
+
+static inline void lb_touch_locked(lb_table_t *t, uint32_t bucket) {
+    if (BUCKET_LIVE(t, bucket)) return;
+    uint32_t base = bucket * t->slots_per_bucket;
+    lb_write_begin(t, bucket);
+    if (t->ready_off != t->bitmap_off)
+        bitmap_clear_range(lb_ready(t), base, t->slots_per_bucket, 1);
+    bitmap_clear_range(lb_bitmap(t), base, t->slots_per_bucket, t->locks_off != 0);
+    __atomic_store_n(&lb_gen(t)[bucket], t->epoch, __ATOMIC_RELEASE);
+    lb_write_end(t, bucket);
+}
+
+static inline void lb_touch(lb_table_t *t, uint32_t bucket) {
+    if (BUCKET_LIVE(t, bucket)) return;
+    if (t->locks_off) spin_lock(LB_STRIPE(t, bucket));
+    lb_touch_locked(t, bucket);
+    if (t->locks_off) spin_unlock(LB_STRIPE(t, bucket));
+}
+
+/* lb_reset empties t in O(1) by advancing the epoch. When the 16-bit epoch wraps, the
+   stamps are cleared so that no bucket stamped 65536 resets ago can look live again.
+   The caller holds every stripe (lb_lock_all).
 */
-int dt_insert(dt_t *dt, const void *key, const void *value) {
-    uint32_t bucket;
-    uint8_t slot;
-    if (lb_insert(dt->primary, key, value, 0xABCDEF01, &bucket, &slot))
-        return 1;
-    if (!lb_grow(dt->primary) ||
-        !lb_insert(dt->primary, key, value, 0xABCDEF01, &bucket, &slot)) {
-        if (!lb_insert(dt->secondary, key, value, 0x12345678, &bucket, &slot)) {
-            if (!lb_grow(dt->secondary) ||
-                !lb_insert(dt->secondary, key, value, 0x12345678, &bucket, &slot))
-                return 0;
+static void lb_reset(lb_table_t *t) {
+    lb_geometry_t g;
+    g.count = t->initial_count;
+    g.num_buckets = fmax(1, g.count / t->slots_per_bucket);
+    __atomic_store_n(&t->geometry, g.word, __ATOMIC_RELEASE);
+    uint16_t epoch = t->epoch + 1;
+    if (epoch == 0) {
+        memset(lb_gen(t), 0, LB_MAX_BUCKETS(t) * sizeof(uint16_t));
+        epoch = 1;
+    }
+    __atomic_store_n(&t->epoch, epoch, __ATOMIC_RELEASE);
+}
+
+/* lb_find scans the bucket for key and stores the slot index of a match in *pos_out.
+   Returns 1 if found, 0 otherwise (a stale bucket never matches).
+   The caller holds the bucket's stripe.
+*/
+static int lb_find(lb_table_t *t, uint32_t bucket, const void *key, uint32_t *pos_out) {
+    if (!BUCKET_LIVE(t, bucket)) return 0;
+    uint32_t base = bucket * t->slots_per_bucket;
+    uint32_t end = base + t->slots_per_bucket;
+    for (uint32_t w = base / 64; w * 64 < end; w++) {
+        uint64_t bits = __atomic_load_n(&lb_ready(t)[w], __ATOMIC_ACQUIRE) & bitmap_mask(w, base, end);
+        while (bits) {
+            uint32_t pos = w * 64 + __builtin_ctzll(bits);
+            if (memcmp(lb_keys(t) + (size_t)pos * t->key_size, key, t->key_size) == 0) {
+                *pos_out = pos;
+                return 1;
+            }
+            bits &= bits - 1;
         }
     }
-    return 1;
+    return 0;
 }
 
-/* dt_lookup and dt_delete use the table_id in the tiny_ptr_t to select the appropriate load-balancing table.
+/* Key history.
+   Growth changes the bucket a key hashes to, and entries are never moved, so a key may sit
+   in its bucket under any geometry the table has had since the last reset. Geometries
+   only ever double from initial_count, so lb_history can list those buckets (at most one
+   per doubling, the current one last) together with the mask of stripes guarding them.
+   Every key-based operation searches that history newest first: lookups probe the current
+   bucket and only go on to the older ones (lb_lookup_older) on a miss in a grown table;
+   deletes, in-place updates and upserts lock every stripe of the history in ascending
+   order (lb_lock_key) and search it under the locks.
 */
-int dt_lookup(dt_t *dt, const void *key, void *value_out) {
-    uint32_t bucket = hash_key(key, dt->primary->key_size, 0xABCDEF01) % dt->primary->num_buckets;
-    uint32_t base = bucket * dt->primary->slots_per_bucket;
-    for (uint32_t i = 0; i < dt->primary->slots_per_bucket; i++) {
-        uint32_t pos = base + i;
-        if (BITMAP_TEST(dt->primary->bitmap, pos) &&
-            memcmp(dt->primary->keys + pos * dt->primary->key_size, key, dt->primary->key_size) == 0) {
-            if (value_out)
-                memcpy(value_out, dt->primary->values + pos * dt->primary->value_size,
-                       dt->primary->value_size);
-            return 1;
+typedef struct {
+    uint32_t buckets[33];       // oldest first; one per doubling of a 32-bit count, plus the current one
+    uint32_t n;
+    uint64_t stripes;           // bit i set if stripe i guards one of the buckets
+} lb_history_t;
+
+static void lb_history(lb_table_t *t, uint32_t hash, lb_geometry_t g, lb_history_t *h) {
+    h->n = 0;
+    h->stripes = 0;
+    for (uint32_t count = t->initial_count;; count = count * 2 > t->max_count ? t->max_count : count * 2) {
+        uint32_t num_buckets = count < g.count ? count / t->slots_per_bucket : g.num_buckets;
+        uint32_t bucket = hash % (num_buckets ? num_buckets : 1);
+        if (!h->n || h->buckets[h->n - 1] != bucket) {
+            h->buckets[h->n++] = bucket;
+            h->stripes |= 1ULL << (bucket % DT_LOCK_STRIPES);
         }
+        if (count >= g.count) break;
     }
-    bucket = hash_key(key, dt->secondary->key_size, 0x12345678) % dt->secondary->num_buckets;
-    base = bucket * dt->secondary->slots_per_bucket;
-    for (uint32_t i = 0; i < dt->secondary->slots_per_bucket; i++) {
-        uint32_t pos = base + i;
-        if (BITMAP_TEST(dt->secondary->bitmap, pos) &&
-            memcmp(dt->secondary->keys + pos * dt->secondary->key_size, key, dt->secondary->key_size) == 0) {
-            if (value_out)
-                memcpy(value_out, dt->secondary->values + pos * dt->secondary->value_size,
-                       dt->secondary->value_size);
+}
+
+static void lb_lock_stripes(lb_table_t *t, uint64_t stripes) {
+    if (!t->locks_off) return;
+    for (; stripes; stripes &= stripes - 1)
+        spin_lock(LB_STRIPE(t, __builtin_ctzll(stripes)));
+}
+
+static void lb_unlock_stripes(lb_table_t *t, uint64_t stripes) {
+    if (!t->locks_off) return;
+    for (; stripes; stripes &= stripes - 1)
+        spin_unlock(LB_STRIPE(t, __builtin_ctzll(stripes)));
+}
+
+/* lb_lock_key builds the history of hash under the current geometry and locks its stripes
+   (release them with lb_unlock_stripes(t, h->stripes)).
+*/
+static void lb_lock_key(lb_table_t *t, uint32_t hash, lb_history_t *h) {
+    lb_history(t, hash, lb_geometry(t), h);
+    lb_lock_stripes(t, h->stripes);
+}
+
+/* lb_find_history is lb_find over every bucket of h, newest first; it also stores the
+   bucket of a match. The caller holds h->stripes.
+*/
+static int lb_find_history(lb_table_t *t, const lb_history_t *h, const void *key,
+                           uint32_t *pos_out, uint32_t *bucket_out) {
+    for (uint32_t i = h->n; i-- > 0;) {
+        if (lb_find(t, h->buckets[i], key, pos_out)) {
+            *bucket_out = h->buckets[i];
             return 1;
         }
     }
     return 0;
 }
 
-int dt_delete(dt_t *dt, const void *key) {
-    uint32_t bucket = hash_key(key, dt->primary->key_size, 0xABCDEF01) % dt->primary->num_buckets;
-    uint32_t base = bucket * dt->primary->slots_per_bucket;
-    for (uint32_t i = 0; i < dt->primary->slots_per_bucket; i++) {
-        uint32_t pos = base + i;
-        if (BITMAP_TEST(dt->primary->bitmap, pos) &&
-            memcmp(dt->primary->keys + pos * dt->primary->key_size, key, dt->primary->key_size) == 0) {
-            BITMAP_CLEAR(dt->primary->bitmap, pos);
-            memset(dt->primary->keys + pos * dt->primary->key_size, 0, dt->primary->key_size);
-            memset(dt->primary->values + pos * dt->primary->value_size, 0, dt->primary->value_size);
+/* lb_claim finds a clear bit in the bucket's slot range and sets it, returning the slot
+   index in *pos_out. In concurrent tables the bit is taken with a CAS on the 64-bit word,
+   so racing inserters can never claim the same slot. The scan starts at word offset start
+   within the bucket and wraps around. Returns 0 if the bucket is full.
+*/
+static int lb_claim(lb_table_t *t, uint32_t bucket, uint32_t start, uint32_t *pos_out) {
+    uint32_t base = bucket * t->slots_per_bucket;
+    uint32_t end = base + t->slots_per_bucket;
+    uint32_t first = base / 64, words = (end - 1) / 64 - first + 1;
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t w = first + (start + i) % words;
+        uint64_t mask = bitmap_mask(w, base, end);
+        uint64_t cur = __atomic_load_n(&lb_bitmap(t)[w], __ATOMIC_RELAXED);
+        while (~cur & mask) {
+            uint64_t bit = (~cur & mask) & -(~cur & mask);
+            if (!t->locks_off) {
+                lb_bitmap(t)[w] = cur | bit;
+            } else if (!__atomic_compare_exchange_n(&lb_bitmap(t)[w], &cur, cur | bit, 1,
+                                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                continue;
+            }
+            *pos_out = w * 64 + __builtin_ctzll(bit);
             return 1;
         }
     }
-    bucket = hash_key(key, dt->secondary->key_size, 0x12345678) % dt->secondary->num_buckets;
-    base = bucket * dt->secondary->slots_per_bucket;
-    for (uint32_t i = 0; i < dt->secondary->slots_per_bucket; i++) {
-        uint32_t pos = base + i;
-        if (BITMAP_TEST(dt->secondary->bitmap, pos) &&
-            memcmp(dt->secondary->keys + pos * dt->secondary->key_size, key, dt->secondary->key_size) == 0) {
-            BITMAP_CLEAR(dt->secondary->bitmap, pos);
-            memset(dt->secondary->keys + pos * dt->secondary->key_size, 0, dt->secondary->key_size);
-            memset(dt->secondary->values + pos * dt->secondary->value_size, 0, dt->secondary->value_size);
-            return 1;
+    return 0;
+}
+
+/* lb_probe is lb_find that also notes, in the same pass over the bucket's words, the first
+   slot whose claim bit is clear (*free_out, or UINT32_MAX if the bucket is full).
+   The caller holds the bucket's stripe and has brought it up to date (lb_touch_locked).
+*/
+static int lb_probe(lb_table_t *t, uint32_t bucket, const void *key, uint32_t *pos_out, uint32_t *free_out) {
+    uint32_t base = bucket * t->slots_per_bucket;
+    uint32_t end = base + t->slots_per_bucket;
+    *free_out = UINT32_MAX;
+    for (uint32_t w = base / 64; w * 64 < end; w++) {
+        uint64_t mask = bitmap_mask(w, base, end);
+        uint64_t bits = __atomic_load_n(&lb_ready(t)[w], __ATOMIC_ACQUIRE) & mask;
+        uint64_t free = ~__atomic_load_n(&lb_bitmap(t)[w], __ATOMIC_RELAXED) & mask;
+        if (free && *free_out == UINT32_MAX)
+            *free_out = w * 64 + __builtin_ctzll(free);
+        for (; bits; bits &= bits - 1) {
+            uint32_t pos = w * 64 + __builtin_ctzll(bits);
+            if (memcmp(lb_keys(t) + (size_t)pos * t->key_size, key, t->key_size) == 0) {
+                *pos_out = pos;
+                return 1;
+            }
         }
     }
     return 0;
 }
 
-void dt_reset(dt_t *dt) {
-    lb_table_t *t = dt->primary;
-    t->count = INITIAL_CAPACITY;
-    t->num_buckets = fmax(1, INITIAL_CAPACITY / t->slots_per_bucket);
-    memset(t->bitmap, 0, (MAX_CAPACITY + 7) / 8);
-    memset(t->keys, 0, MAX_CAPACITY * t->key_size);
-    memset(t->values, 0, MAX_CAPACITY * t->value_size);
-
-    t = dt->secondary;
-    t->count = INITIAL_CAPACITY;
-    t->num_buckets = fmax(1, INITIAL_CAPACITY / t->slots_per_bucket);
-    memset(t->bitmap, 0, (MAX_CAPACITY + 7) / 8);
-    memset(t->keys, 0, MAX_CAPACITY * t->key_size);
-    memset(t->values, 0, MAX_CAPACITY * t->value_size);
+/* lb_claim_at claims slot pos if it is still free, else any free slot of bucket (a
+   lock-free dt_insert may have taken it meanwhile). Returns 0 if the bucket is full.
+*/
+static int lb_claim_at(lb_table_t *t, uint32_t bucket, uint32_t pos, uint32_t *pos_out) {
+    uint64_t bit = 1ULL << (pos % 64);
+    if (!t->locks_off) {
+        lb_bitmap(t)[pos / 64] |= bit;
+        *pos_out = pos;
+        return 1;
+    }
+    if (!(__atomic_fetch_or(&lb_bitmap(t)[pos / 64], bit, __ATOMIC_ACQUIRE) & bit)) {
+        *pos_out = pos;
+        return 1;
+    }
+    return lb_claim(t, bucket, 0, pos_out);
+}
+
+/* lb_claim_many claims up to want free slots of bucket, taking as many as one word offers
+   with a single load and CAS, and stores their indices in pos_out. Returns how many it got.
+*/
+static uint32_t lb_claim_many(lb_table_t *t, uint32_t bucket, uint32_t want, uint32_t *pos_out) {
+    uint32_t base = bucket * t->slots_per_bucket;
+    uint32_t end = base + t->slots_per_bucket;
+    uint32_t got = 0;
+    for (uint32_t w = base / 64; w * 64 < end && got < want; w++) {
+        uint64_t mask = bitmap_mask(w, base, end);
+        uint64_t cur = __atomic_load_n(&lb_bitmap(t)[w], __ATOMIC_RELAXED);
+        for (;;) {
+            uint64_t free = ~cur & mask, take = 0;
+            for (uint32_t k = got; free && k < want; k++) {
+                take |= free & -free;
+                free &= free - 1;
+            }
+            if (!take) break;
+            if (!t->locks_off) {
+                lb_bitmap(t)[w] = cur | take;
+            } else if (!__atomic_compare_exchange_n(&lb_bitmap(t)[w], &cur, cur | take, 1,
+                                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                continue;
+            }
+            for (; take; take &= take - 1)
+                pos_out[got++] = w * 64 + __builtin_ctzll(take);
+            break;
+        }
+    }
+    return got;
+}
+
+/* lb_publish makes a claimed slot visible to readers once its key and value are written
+   (release ordering); lb_unpublish hides it again, and lb_release returns a hidden slot to
+   the free pool (with DT_WIPE_ON_DELETE, after zeroing its key and value). Concurrent
+   tables may put time between the last two, see dt_release.
+   Without DT_CONCURRENT ready aliases bitmap, the claim itself is the publication, and
+   lb_unpublish does nothing.
+*/
+static inline void lb_publish(lb_table_t *t, uint32_t pos) {
+    if (t->ready_off != t->bitmap_off)
+        __atomic_fetch_or(&lb_ready(t)[pos / 64], 1ULL << (pos % 64), __ATOMIC_RELEASE);
+}
+
+static inline void lb_unpublish(lb_table_t *t, uint32_t pos) {
+    if (t->ready_off != t->bitmap_off)
+        __atomic_fetch_and(&lb_ready(t)[pos / 64], ~(1ULL << (pos % 64)), __ATOMIC_RELEASE);
+}
+
+static inline void lb_release(lb_table_t *t, uint32_t pos) {
+#ifdef DT_WIPE_ON_DELETE
+    memset(lb_keys(t) + (size_t)pos * t->key_size, 0, t->key_size);
+    memset(lb_values(t) + (size_t)pos * t->value_size, 0, t->value_size);
+#endif
+    if (t->ready_off != t->bitmap_off)
+        __atomic_fetch_and(&lb_bitmap(t)[pos / 64], ~(1ULL << (pos % 64)), __ATOMIC_RELEASE);
+    else
+        BITMAP_CLEAR(lb_bitmap(t), pos);
+}
+
+/* lb_insert attempts to insert a key/value pair into table t.
+   It hashes the key with the provided seed, chooses a bucket, and then claims a free slot in it.
+   No lock is taken: a bucket chosen under the old geometry while another thread grows the
+   table is still backed by reserved memory, so the entry simply lands there.
+   hints (this thread's hint cache for t, or NULL) picks the word to start claiming from.
+   If value is NULL the value is left unwritten and the slot unpublished, for the caller to
+   fill and publish itself (see dt_alloc).
+   Returns 1 if insertion succeeds (and outputs bucket and slot used via pointers),
+   or 0 if the entire bucket is full (in which case the caller may attempt to grow t).
+*/
+static int lb_insert(lb_table_t *t, const void *key, const void *value, uint32_t seed,
+                     dt_hint_t *hints, uint32_t salt, uint32_t *bucket_out, uint8_t *slot_out) {
+    uint32_t bucket = hash_key(key, t->key_size, seed) % lb_geometry(t).num_buckets;
+    dt_hint_t *hint = hints ? &hints[bucket % DT_HINT_SLOTS] : NULL;
+    uint32_t pos;
+    lb_touch(t, bucket);
+    if (!lb_claim(t, bucket, !hint ? 0 : hint->bucket == bucket + 1 ? hint->word : salt, &pos))
+        return 0; // Insertion fails if bucket is full
+    if (hint) {
+        hint->bucket = bucket + 1;
+        hint->word = pos / 64 - bucket * t->slots_per_bucket / 64;
+    }
+    memcpy(lb_keys(t) + (size_t)pos * t->key_size, key, t->key_size);
+    if (value) {
+        memcpy(lb_values(t) + (size_t)pos * t->value_size, value, t->value_size);
+        lb_publish(t, pos);
+    }
+    *bucket_out = bucket;
+    *slot_out = (uint8_t)(pos - bucket * t->slots_per_bucket);
+    return 1;
+}
+
+/* lb_insert_grow is one level of dt_insert: try t, and if the bucket is full grow t
+   once and try again.
+*/
+static int lb_insert_grow(lb_table_t *t, const void *key, const void *value, uint32_t seed,
+                          dt_hint_t *hints, uint32_t salt, uint32_t *bucket_out, uint8_t *slot_out) {
+    uint32_t seen = lb_geometry(t).count;
+    if (lb_insert(t, key, value, seed, hints, salt, bucket_out, slot_out))
+        return 1;
+    return lb_grow(t, seen) && lb_insert(t, key, value, seed, hints, salt, bucket_out, slot_out);
+}
+
+/* lb_lookup copies the value stored under key (if value_out is non-NULL).
+   Returns 1 if found, 0 otherwise.
+   In concurrent tables it takes no lock: the probe and the copy run optimistically between
+   two reads of the bucket's sequence counter and are simply redone if a writer interfered.
+   A resize in the meantime is harmless; the result is that of the geometry first read.
+   lb_bucket_of maps a hash to its bucket under that geometry; lb_lookup_bucket is the
+   probe for an already chosen bucket.
+*/
+static inline uint32_t lb_bucket_of(lb_table_t *t, uint32_t hash) {
+    return hash % (t->seq_off ? lb_geometry(t).num_buckets : t->num_buckets);
+}
+
+static int lb_lookup_bucket(lb_table_t *t, uint32_t bucket, const void *key, void *value_out) {
+    uint32_t pos;
+    if (!t->seq_off) {
+        int found = lb_find(t, bucket, key, &pos);
+        if (found && value_out)
+            memcpy(value_out, lb_values(t) + (size_t)pos * t->value_size, t->value_size);
+        return found;
+    }
+    for (;;) {
+        uint32_t before = __atomic_load_n(&lb_seq(t)[bucket], __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            CPU_RELAX();
+            continue;
+        }
+        int found = lb_find(t, bucket, key, &pos);
+        if (found && value_out)
+            memcpy(value_out, lb_values(t) + (size_t)pos * t->value_size, t->value_size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&lb_seq(t)[bucket], __ATOMIC_RELAXED) == before)
+            return found;
+    }
+}
+
+/* lb_lookup_older probes the buckets key had under earlier geometries (see Key history),
+   skipping bucket, which the caller has probed already. A table that never grew since the
+   last reset has none, and the key is not even hashed again.
+*/
+static int lb_lookup_older(lb_table_t *t, const void *key, uint32_t seed, uint32_t bucket, void *value_out) {
+    lb_geometry_t g = lb_geometry(t);
+    if (g.count == t->initial_count) return 0;
+    lb_history_t h;
+    lb_history(t, hash_key(key, t->key_size, seed), g, &h);
+    for (uint32_t i = h.n; i-- > 0;)
+        if (h.buckets[i] != bucket && lb_lookup_bucket(t, h.buckets[i], key, value_out))
+            return 1;
+    return 0;
+}
+
+static int lb_lookup(lb_table_t *t, const void *key, uint32_t seed, void *value_out) {
+    uint32_t bucket = lb_bucket_of(t, hash_key(key, t->key_size, seed));
+    return lb_lookup_bucket(t, bucket, key, value_out) || lb_lookup_older(t, key, seed, bucket, value_out);
+}
+
+/* lb_find_ref is lb_lookup returning where the value lives instead of copying it, or NULL.
+   In concurrent tables the probe is validated against the bucket's sequence counter like
+   any lookup; what the caller then reads through the pointer is not.
+*/
+static void *lb_find_ref_bucket(lb_table_t *t, uint32_t bucket, const void *key) {
+    uint32_t pos;
+    if (!t->seq_off)
+        return lb_find(t, bucket, key, &pos) ? lb_values(t) + (size_t)pos * t->value_size : NULL;
+    for (;;) {
+        uint32_t before = __atomic_load_n(&lb_seq(t)[bucket], __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            CPU_RELAX();
+            continue;
+        }
+        int found = lb_find(t, bucket, key, &pos);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&lb_seq(t)[bucket], __ATOMIC_RELAXED) == before)
+            return found ? lb_values(t) + (size_t)pos * t->value_size : NULL;
+    }
+}
+
+static void *lb_find_ref(lb_table_t *t, const void *key, uint32_t seed) {
+    uint32_t hash = hash_key(key, t->key_size, seed);
+    lb_geometry_t g = lb_geometry(t);
+    void *value = lb_find_ref_bucket(t, hash % g.num_buckets, key);
+    if (value || g.count == t->initial_count) return value;
+    lb_history_t h;
+    lb_history(t, hash, g, &h);
+    for (uint32_t i = h.n - 1; !value && i-- > 0;)
+        value = lb_find_ref_bucket(t, h.buckets[i], key);
+    return value;
+}
+
+/* lb_prefetch_bucket asks for everything a probe of bucket reads first: its stamp and
+   sequence counter, its words of the published bitmap, and the cache lines of its keys.
+*/
+static inline void lb_prefetch_bucket(lb_table_t *t, uint32_t bucket) {
+    uint32_t base = bucket * t->slots_per_bucket;
+    __builtin_prefetch(&lb_gen(t)[bucket]);
+    if (t->seq_off)
+        __builtin_prefetch(&lb_seq(t)[bucket]);
+    for (uint32_t w = base / 64; w * 64 < base + t->slots_per_bucket; w++)
+        __builtin_prefetch(&lb_ready(t)[w]);
+    const char *k = lb_keys(t) + (size_t)base * t->key_size;
+    for (size_t off = 0; off < (size_t)t->slots_per_bucket * t->key_size; off += DT_ALIGN)
+        __builtin_prefetch(k + off);
+}
+
+/* lb_delete hides the slot holding key and stores its index in *pos_out; the caller
+   still has to lb_release it (or retire it, see dt_release). If value_out is non-NULL the
+   value is copied there first, within the same probe. Returns 1 if found, 0 otherwise.
+*/
+static int lb_delete(lb_table_t *t, const void *key, uint32_t seed, void *value_out, uint32_t *pos_out) {
+    lb_history_t h;
+    uint32_t bucket;
+    lb_lock_key(t, hash_key(key, t->key_size, seed), &h);
+    int found = lb_find_history(t, &h, key, pos_out, &bucket);
+    if (found) {
+        if (value_out)
+            memcpy(value_out, lb_values(t) + (size_t)*pos_out * t->value_size, t->value_size);
+        lb_write_begin(t, bucket);
+        lb_unpublish(t, *pos_out);
+        lb_write_end(t, bucket);
+    }
+    lb_unlock_stripes(t, h.stripes);
+    return found;
+}
+
+/* lb_rmw applies an atomic read-modify-write to the 8-byte value stored under key: with
+   LB_RMW_CAS it stores arg if the value equals *word, else copies the current value to
+   *word; with LB_RMW_ADD it adds arg and returns the old value in *word.
+   Returns 1 if the value was changed, 0 on a CAS mismatch, -1 if key is absent.
+   The bucket's stripe keeps a delete from recycling the slot under the update, and the
+   sequence bump makes optimistic readers retry instead of copying a half-done value.
+*/
+enum { LB_RMW_CAS, LB_RMW_ADD };
+
+static int lb_rmw(lb_table_t *t, const void *key, uint32_t seed, int op, uint64_t *word, uint64_t arg) {
+    lb_history_t h;
+    uint32_t pos, bucket;
+    int result = -1;
+    lb_lock_key(t, hash_key(key, t->key_size, seed), &h);
+    if (lb_find_history(t, &h, key, &pos, &bucket)) {
+        uint64_t *value = (uint64_t *)(lb_values(t) + (size_t)pos * sizeof(uint64_t));
+        lb_write_begin(t, bucket);
+        if (op == LB_RMW_ADD) {
+            *word = __atomic_fetch_add(value, arg, __ATOMIC_ACQ_REL);
+            result = 1;
+        } else {
+            result = __atomic_compare_exchange_n(value, word, arg, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        }
+        lb_write_end(t, bucket);
+    }
+    lb_unlock_stripes(t, h.stripes);
+    return result;
+}
+
+/*-------------------------------------------------------------------------
+   Epoch-Based Reclamation
+-------------------------------------------------------------------------*/
+
+#define DT_READER(dt, i) (dt_readers(dt)[(i) * (DT_ALIGN / sizeof(uint64_t))])
+
+/* Overflow lists.
+   A slot is named by its index over both tables (secondary slots follow the primary's
+   max_count) plus one, and dt_overflow links it to the next one on its list. Deletes go
+   on the open list; when the sealed list is empty the open list is sealed, and a sealed
+   list is released as a whole once every reader is younger than its newest delete. The
+   lists are therefore freed in batches, but never hold up a writer.
+*/
+static void dt_overflow_push(dt_t *dt, uint32_t table_id, uint32_t pos, uint64_t epoch) {
+    uint32_t index = (table_id ? dt->primary.max_count : 0) + pos;
+    dt_overflow(dt)[index] = dt->overflow_open;
+    dt->overflow_open = index + 1;
+    dt->open_epoch = epoch;
+}
+
+static uint32_t dt_overflow_release(dt_t *dt, uint32_t head) {
+    uint32_t released = 0;
+    while (head) {
+        uint32_t index = head - 1;
+        head = dt_overflow(dt)[index];
+        if (index < dt->primary.max_count)
+            lb_release(&dt->primary, index);
+        else
+            lb_release(&dt->secondary, index - dt->primary.max_count);
+        released++;
+    }
+    return released;
+}
+
+/* dt_reclaim_locked releases every retired slot that no registered reader can still see:
+   those deleted before the oldest reader entered. A reader slot that is claimed but not
+   yet stamped blocks everything. The caller holds retire_lock. Returns the number released.
+*/
+static uint32_t dt_reclaim_locked(dt_t *dt) {
+    uint64_t oldest = UINT64_MAX;
+    uint64_t mask = __atomic_load_n(&dt->reader_mask, __ATOMIC_SEQ_CST);
+    while (mask) {
+        uint64_t e = __atomic_load_n(&DT_READER(dt, __builtin_ctzll(mask)), __ATOMIC_SEQ_CST);
+        if (e < oldest) oldest = e;
+        mask &= mask - 1;
+    }
+    uint32_t released = 0;
+    while (dt->retire_tail != dt->retire_head) {
+        dt_retired_t *r = &dt_retired(dt)[dt->retire_tail % DT_RETIRE_SLOTS];
+        if (r->epoch >= oldest) break;
+        lb_release(r->table_id ? &dt->secondary : &dt->primary, r->pos);
+        dt->retire_tail++;
+        released++;
+    }
+    for (;;) {
+        if (dt->overflow_sealed) {
+            if (dt->sealed_epoch >= oldest) break;
+            released += dt_overflow_release(dt, dt->overflow_sealed);
+            dt->overflow_sealed = 0;
+        }
+        if (!dt->overflow_open) break;
+        dt->overflow_sealed = dt->overflow_open;
+        dt->sealed_epoch = dt->open_epoch;
+        dt->overflow_open = 0;
+    }
+    return released;
+}
+
+/* dt_release finishes a delete of slot pos in table table_id (already hidden by lb_delete).
+   If no reader is registered the slot is freed at once, exactly as without reclamation.
+   Otherwise it is tagged with the current epoch and retired; a full ring is drained first,
+   and if its oldest entry is still pinned the slot goes on the overflow list.
+   The fence pairs with the one in dt_read_begin: either the deleter sees the reader, or
+   the reader sees the slot already hidden.
+*/
+static void dt_release(dt_t *dt, uint32_t table_id, uint32_t pos) {
+    lb_table_t *t = table_id ? &dt->secondary : &dt->primary;
+    if (!dt->readers_off) {
+        lb_release(t, pos);
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&dt->reader_mask, __ATOMIC_RELAXED)) {
+        lb_release(t, pos);
+        return;
+    }
+    spin_lock(&dt->retire_lock);
+    uint64_t epoch = __atomic_fetch_add(&dt->read_epoch, 1, __ATOMIC_SEQ_CST);
+    if (dt->retire_head - dt->retire_tail == DT_RETIRE_SLOTS)
+        dt_reclaim_locked(dt);
+    // Reclaim may free only overflow slots, so check the ring itself again.
+    if (dt->retire_head - dt->retire_tail == DT_RETIRE_SLOTS) {
+        dt_overflow_push(dt, table_id, pos, epoch);
+        spin_unlock(&dt->retire_lock);
+        return;
+    }
+    dt_retired_t *r = &dt_retired(dt)[dt->retire_head % DT_RETIRE_SLOTS];
+    r->epoch = epoch;
+    r->pos = pos;
+    r->table_id = table_id;
+    dt->retire_head++;
+    if (dt->retire_head - dt->retire_tail >= DT_RETIRE_SLOTS / 2)
+        dt_reclaim_locked(dt);
+    spin_unlock(&dt->retire_lock);
+}
+
+/* dt_read_begin registers the caller as a reader and returns its reader slot (pass it to
+   dt_read_end), or -1 if all DT_MAX_READERS slots are taken. Until dt_read_end, no slot
+   the reader can observe is recycled: value pointers from dt_deref stay valid and keep
+   their contents even if the key is deleted meanwhile, and writers never wait for it.
+   Plain dt_lookup calls do not need a read section. For tables without DT_CONCURRENT
+   this is a no-op returning 0.
+*/
+int dt_read_begin(dt_t *dt) {
+    if (!dt->readers_off) return 0;
+    uint64_t mask = __atomic_load_n(&dt->reader_mask, __ATOMIC_RELAXED);
+    for (;;) {
+        if (!~mask) return -1;
+        int i = __builtin_ctzll(~mask);
+        if (!__atomic_compare_exchange_n(&dt->reader_mask, &mask, mask | (1ULL << i), 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            continue;
+        __atomic_store_n(&DT_READER(dt, i), __atomic_load_n(&dt->read_epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        return i;
+    }
+}
+
+/* dt_read_end leaves a read section and, if slots are waiting and nobody else is draining
+   the ring, releases whatever this reader was the last to pin.
+*/
+void dt_read_end(dt_t *dt, int reader) {
+    if (!dt->readers_off || reader < 0) return;
+    __atomic_store_n(&DT_READER(dt, reader), 0, __ATOMIC_RELEASE);
+    __atomic_fetch_and(&dt->reader_mask, ~(1ULL << reader), __ATOMIC_RELEASE);
+    uint32_t head = __atomic_load_n(&dt->retire_head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&dt->retire_tail, __ATOMIC_RELAXED) &&
+        !__atomic_load_n(&dt->overflow_open, __ATOMIC_RELAXED) &&
+        !__atomic_load_n(&dt->overflow_sealed, __ATOMIC_RELAXED))
+        return;
+    if (__atomic_exchange_n(&dt->retire_lock, 1, __ATOMIC_ACQUIRE))
+        return;
+    dt_reclaim_locked(dt);
+    spin_unlock(&dt->retire_lock);
+}
+
+/* dt_reclaim releases every retired slot no reader can still see and returns how many. */
+uint32_t dt_reclaim(dt_t *dt) {
+    if (!dt->readers_off) return 0;
+    spin_lock(&dt->retire_lock);
+    uint32_t released = dt_reclaim_locked(dt);
+    spin_unlock(&dt->retire_lock);
+    return released;
+}
+
+/*-------------------------------------------------------------------------
+   Worker Pool (dt_workers_t)
+-------------------------------------------------------------------------*/
+
+static _Thread_local dt_workers_t *dt_worker_pool; // pool whose job this thread is running
+
+static void *dt_worker_main(void *arg) {
+    dt_workers_t *w = arg;
+    uint64_t seen = 0;
+    dt_worker_pool = w;
+    pthread_mutex_lock(&w->lock);
+    unsigned index = w->started++;
+    for (;;) {
+        while (w->round == seen && !w->stop)
+            pthread_cond_wait(&w->wake, &w->lock);
+        if (w->stop) break;
+        seen = w->round;
+        dt_job_fn fn = w->fn;
+        void *ctx = w->ctx;
+        pthread_mutex_unlock(&w->lock);
+        fn(ctx, index, w->num_workers);
+        pthread_mutex_lock(&w->lock);
+        if (--w->pending == 0)
+            pthread_cond_signal(&w->done);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* dt_workers_create starts num_workers - 1 helper threads (at most DT_MAX_WORKERS in
+   all). Returns NULL if num_workers < 2 or a thread cannot be started.
+*/
+dt_workers_t *dt_workers_create(unsigned num_workers) {
+    if (num_workers < 2) return NULL;
+    if (num_workers > DT_MAX_WORKERS) num_workers = DT_MAX_WORKERS;
+    dt_workers_t *w = xmap(sizeof(dt_workers_t));
+    if (!w) return NULL;
+    w->num_workers = 1;
+    w->started = 1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->idle, NULL);
+    pthread_cond_init(&w->wake, NULL);
+    pthread_cond_init(&w->done, NULL);
+    for (unsigned i = 1; i < num_workers; i++) {
+        if (pthread_create(&w->threads[i], NULL, dt_worker_main, w) != 0) {
+            dt_workers_destroy(w);
+            return NULL;
+        }
+        w->num_workers++;
+    }
+    return w;
+}
+
+void dt_workers_destroy(dt_workers_t *w) {
+    if (!w) return;
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    for (unsigned i = 1; i < w->num_workers; i++)
+        pthread_join(w->threads[i], NULL);
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->wake);
+    pthread_cond_destroy(&w->idle);
+    pthread_mutex_destroy(&w->lock);
+    munmap(w, sizeof(dt_workers_t));
+}
+
+/* dt_workers_run calls fn(ctx, i, n) once for every worker i < n and returns n when all
+   calls have finished. With w == NULL it is just fn(ctx, 0, 1). Jobs from different
+   threads are run one after the other; a caller that finds the pool busy sleeps on the
+   pool's condition variable. A job started from inside a job of the same pool (say a
+   dt_count in a dt_parallel_for_each callback) runs as fn(ctx, 0, 1) on the calling
+   thread instead of waiting for itself, so callers must size their results by the n
+   returned, not by the pool.
+*/
+unsigned dt_workers_run(dt_workers_t *w, dt_job_fn fn, void *ctx) {
+    if (!w || w->num_workers < 2 || dt_worker_pool == w) {
+        fn(ctx, 0, 1);
+        return 1;
+    }
+    pthread_mutex_lock(&w->lock);
+    while (w->busy)
+        pthread_cond_wait(&w->idle, &w->lock);
+    w->busy = 1;
+    w->fn = fn;
+    w->ctx = ctx;
+    w->pending = w->num_workers - 1;
+    w->round++;
+    pthread_cond_broadcast(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    dt_workers_t *outer = dt_worker_pool;
+    dt_worker_pool = w;
+    fn(ctx, 0, w->num_workers);
+    dt_worker_pool = outer;
+    pthread_mutex_lock(&w->lock);
+    while (w->pending)
+        pthread_cond_wait(&w->done, &w->lock);
+    w->busy = 0;
+    pthread_cond_signal(&w->idle);
+    pthread_mutex_unlock(&w->lock);
+    return w->num_workers;
+}
+
+/* dt_split gives worker i of n its share [*begin, *end) of n_items: contiguous ranges,
+   as even as possible, in worker order.
+*/
+static inline void dt_split(uint64_t n_items, unsigned i, unsigned n, uint64_t *begin, uint64_t *end) {
+    *begin = n_items * i / n;
+    *end = n_items * (i + 1) / n;
+}
+
+/*-------------------------------------------------------------------------
+   Dereference Table (dt_t) Functions
+-------------------------------------------------------------------------*/
+
+/* dt_layout measures (dt == NULL) or carves (dt != NULL) the region for a table:
+   the dt_t header first, then the primary and secondary arrays, then (for DT_CONCURRENT)
+   the reader slots, the retire ring and the overflow links. Returns the size in bytes.
+*/
+static size_t dt_layout(dt_t *dt, const dt_config_t *cfg) {
+    lb_table_t primary, secondary;
+    lb_table_t *p = dt ? &dt->primary : &primary;
+    lb_table_t *s = dt ? &dt->secondary : &secondary;
+    lb_init(p, cfg, PRIMARY_BUCKET_SIZE);
+    lb_init(s, cfg, SECONDARY_BUCKET_SIZE);
+    size_t off = lb_carve(p, (char *)dt, sizeof(dt_t));
+    off = lb_carve(s, (char *)dt, off);
+    size_t readers = ALIGN_UP(off, DT_ALIGN);
+    size_t retired = readers + DT_MAX_READERS * DT_ALIGN;
+    size_t overflow = ALIGN_UP(retired + DT_RETIRE_SLOTS * sizeof(dt_retired_t), DT_ALIGN);
+    int concurrent = (cfg->flags & DT_CONCURRENT) != 0;
+    if (dt) {
+        dt->readers_off = concurrent ? readers : 0;
+        dt->retired_off = concurrent ? retired : 0;
+        dt->overflow_off = concurrent ? overflow : 0;
+        dt->read_epoch = 1;
+    }
+    if (!concurrent) return off;
+    return overflow + ((size_t)p->max_count + s->max_count) * sizeof(uint32_t);
+}
+
+/* dt_footprint returns how many bytes dt_init_in needs for config, including slack for
+   aligning an arbitrary buffer to DT_ALIGN.
+*/
+size_t dt_footprint(const dt_config_t *config) {
+    return dt_layout(NULL, config) + DT_ALIGN - 1;
+}
+
+/* dt_init_in builds a table inside caller-owned memory (buffer need not be zeroed).
+   Only the header, the generation stamps, sequence counters, locks and reader slots are
+   initialised; keys, values and bitmap bits are picked up lazily through the stamps.
+   Returns NULL if size is less than dt_footprint(config). The caller frees buffer after
+   it is done with the table; dt_destroy does nothing for such tables.
+*/
+dt_t *dt_init_in(void *buffer, size_t size, const dt_config_t *config) {
+    if (!buffer || size < dt_footprint(config)) return NULL;
+    dt_t *dt = (dt_t *)ALIGN_UP((uintptr_t)buffer, DT_ALIGN);
+    memset(dt, 0, sizeof(dt_t));
+    dt_layout(dt, config);
+    memset(lb_gen(&dt->primary), 0, LB_MAX_BUCKETS(&dt->primary) * sizeof(uint16_t));
+    memset(lb_gen(&dt->secondary), 0, LB_MAX_BUCKETS(&dt->secondary) * sizeof(uint16_t));
+    if (dt->primary.locks_off) {
+        memset(lb_seq(&dt->primary), 0, LB_MAX_BUCKETS(&dt->primary) * sizeof(uint32_t));
+        memset(lb_seq(&dt->secondary), 0, LB_MAX_BUCKETS(&dt->secondary) * sizeof(uint32_t));
+        memset(lb_locks(&dt->primary), 0, DT_LOCK_STRIPES * DT_ALIGN);
+        memset(lb_locks(&dt->secondary), 0, DT_LOCK_STRIPES * DT_ALIGN);
+        memset(dt_readers(dt), 0, DT_MAX_READERS * DT_ALIGN);
+    }
+    return dt;
+}
+
+/* dt_create_ex reserves a single mapping of dt_footprint(config) bytes and carves both
+   load-balancing tables out of it:
+   - primary: uses PRIMARY_BUCKET_SIZE and starts at the initial capacity.
+   - secondary: uses SECONDARY_BUCKET_SIZE and also starts at the initial capacity.
+   (In a full implementation for variable-length tiny pointers, the value array could use zone aggregation.
+    Here, we use fixed-size tiny pointers, but dynamic resizing via doubling is supported.)
+   The mapping comes back zeroed, so the stamps need no clearing.
+*/
+dt_t *dt_create_ex(const dt_config_t *config) {
+    size_t size = dt_layout(NULL, config);
+    void *p = xmap(size);
+    if (!p) return NULL;
+    dt_t *dt = p;
+    dt_layout(dt, config);
+    dt->size = size;
+    if (config->num_workers > 1 && !(dt->workers = dt_workers_create(config->num_workers))) {
+        munmap(p, size);
+        return NULL;
+    }
+    return dt;
+}
+
+dt_t *dt_create(size_t key_size, size_t value_size) {
+    dt_config_t config = { key_size, value_size, MAX_CAPACITY, INITIAL_CAPACITY, 0, 0 };
+    return dt_create_ex(&config);
+}
+
+/* dt_destroy stops the table's workers and releases its mapping with a single munmap.
+   (Tables built with dt_init_in live in caller memory and are left alone.)
+*/
+void dt_destroy(dt_t *dt) {
+    if (!dt) return;
+    dt_workers_destroy(dt->workers);
+    if (dt->size)
+        munmap(dt, dt->size);
+}
+
+/* dt_insert_impl first attempts to insert into the primary table.
+   If insertion fails (bucket full), then it tries to grow the primary table.
+   If still failing, it attempts insertion (and growth) in the secondary table.
+   The tiny_ptr_t written to tp_out (if non-NULL) encodes which table was used plus the
+   bucket and slot; on failure its table_id is 0xFF.
+   (In a more elaborate design, one could incorporate zone-aggregated storage for variable-length pointers.)
+*/
+static int dt_insert_impl(dt_t *dt, dt_thread_t *ts, const void *key, const void *value,
+                          tiny_ptr_t *tp_out) {
+    tiny_ptr_t tp = { 0, 0, 0, 0 };
+    uint32_t salt = ts ? ts->salt : 0;
+    if (!lb_insert_grow(&dt->primary, key, value, PRIMARY_SEED, ts ? ts->hints[0] : NULL, salt,
+                        &tp.bucket, &tp.slot)) {
+        tp.table_id = 1;
+        if (!lb_insert_grow(&dt->secondary, key, value, SECONDARY_SEED, ts ? ts->hints[1] : NULL, salt,
+                            &tp.bucket, &tp.slot))
+            tp.table_id = 0xFF;
+    }
+    if (tp_out)
+        *tp_out = tp;
+    return tp.table_id != 0xFF;
+}
+
+int dt_insert_tp(dt_t *dt, const void *key, const void *value, tiny_ptr_t *tp_out) {
+    return dt_insert_impl(dt, NULL, key, value, tp_out);
+}
+
+int dt_insert(dt_t *dt, const void *key, const void *value) {
+    return dt_insert_impl(dt, NULL, key, value, NULL);
+}
+
+/* dt_thread_init prepares per-thread insertion state; thread_id only needs to differ
+   between threads (it seeds the stagger).
+*/
+void dt_thread_init(dt_thread_t *ts, uint32_t thread_id) {
+    memset(ts, 0, sizeof(*ts));
+    ts->salt = thread_id;
+}
+
+/* dt_insert_hinted is dt_insert using the calling thread's hints (see dt_thread_t). */
+int dt_insert_hinted(dt_t *dt, dt_thread_t *ts, const void *key, const void *value) {
+    return dt_insert_impl(dt, ts, key, value, NULL);
+}
+
+/* dt_deref follows a tiny pointer to its value without hashing or probing.
+   Returns NULL if tp does not name a live, published slot (e.g. after a delete or reset).
+   A tiny pointer names a slot, not a key: after a delete the slot may be reused, unless
+   the caller is inside a read section (dt_read_begin), which holds off the reuse.
+*/
+void *dt_deref(dt_t *dt, tiny_ptr_t tp) {
+    if (tp.table_id > 1) return NULL;
+    lb_table_t *t = tp.table_id ? &dt->secondary : &dt->primary;
+    if (tp.bucket >= LB_MAX_BUCKETS(t) || tp.slot >= t->slots_per_bucket) return NULL;
+    uint32_t pos = tp.bucket * t->slots_per_bucket + tp.slot;
+    if (!BUCKET_LIVE(t, tp.bucket) || !BITMAP_TEST(lb_ready(t), pos)) return NULL;
+    return lb_values(t) + (size_t)pos * t->value_size;
+}
+
+/* dt_lookup and dt_delete probe the primary table first and fall back to the secondary.
+*/
+int dt_lookup(dt_t *dt, const void *key, void *value_out) {
+    return lb_lookup(&dt->primary, key, PRIMARY_SEED, value_out) ||
+           lb_lookup(&dt->secondary, key, SECONDARY_SEED, value_out);
+}
+
+/* In-place value access.
+   dt_find_ref returns a pointer to the value stored under key (NULL if absent), and
+   dt_alloc claims a slot for key and returns a pointer to its still unwritten value
+   (NULL if the table is full); the caller fills it in place and then calls dt_commit,
+   which publishes the entry to lookups. Neither copies the value.
+   Stability: entries never move (growth only adds buckets), so a pointer stays valid until
+   its key is deleted or the table is reset or rebuilt (dt_reset, dt_build). In concurrent
+   tables a delete by another thread can hand the slot to a new key at any moment, unless
+   the pointer was obtained and is used inside a read section (dt_read_begin), which holds
+   off that reuse. Writes through the pointer are plain stores: concurrent dt_lookup calls
+   may copy a half-written value, so update shared values with dt_upsert instead.
+   Like dt_insert, dt_alloc does not check whether key is already present. A slot that is
+   never committed stays claimed but invisible (without DT_CONCURRENT, the claim is the
+   publication and dt_commit does nothing).
+*/
+void *dt_find_ref(dt_t *dt, const void *key) {
+    void *value = lb_find_ref(&dt->primary, key, PRIMARY_SEED);
+    return value ? value : lb_find_ref(&dt->secondary, key, SECONDARY_SEED);
+}
+
+void *dt_alloc(dt_t *dt, const void *key) {
+    tiny_ptr_t tp;
+    if (!dt_insert_impl(dt, NULL, key, NULL, &tp)) return NULL;
+    lb_table_t *t = tp.table_id ? &dt->secondary : &dt->primary;
+    uint32_t pos = tp.bucket * t->slots_per_bucket + tp.slot;
+    return lb_values(t) + (size_t)pos * t->value_size;
+}
+
+void dt_commit(dt_t *dt, void *value) {
+    lb_table_t *t = &dt->primary;
+    size_t off = (size_t)((char *)value - lb_values(t));
+    if ((char *)value < lb_values(t) || off >= (size_t)t->max_count * t->value_size) {
+        t = &dt->secondary;
+        off = (size_t)((char *)value - lb_values(t));
+    }
+    lb_publish(t, (uint32_t)(off / t->value_size));
+}
+
+/* Prefetch hints for callers that pipeline their own work.
+   dt_prefetch computes key's primary bucket and prefetches what a lookup there reads first
+   (see lb_prefetch_bucket) without probing it; with_value also requests the first line of
+   the bucket's values, where a bucket filled front to back keeps its oldest entries.
+   dt_prefetch_hashed does the same for a hash already obtained from dt_hash, so the key
+   need not be hashed twice. Keys that overflowed to the secondary table are not covered.
+*/
+uint32_t dt_hash(const dt_t *dt, const void *key) {
+    return hash_key(key, dt->primary.key_size, PRIMARY_SEED);
+}
+
+void dt_prefetch_hashed(dt_t *dt, uint32_t hash, int with_value) {
+    lb_table_t *t = &dt->primary;
+    uint32_t bucket = lb_bucket_of(t, hash);
+    lb_prefetch_bucket(t, bucket);
+    if (with_value)
+        __builtin_prefetch(lb_values(t) + (size_t)bucket * t->slots_per_bucket * t->value_size);
+}
+
+void dt_prefetch(dt_t *dt, const void *key, int with_value) {
+    dt_prefetch_hashed(dt, dt_hash(dt, key), with_value);
+}
+
+/* dt_lookup_batch looks up n keys stored back to back in keys. The value of key i is
+   copied to the i-th value_size slot of values_out (if non-NULL) and found_out[i] (if
+   non-NULL) is set to 1 or 0. Returns the number of keys found.
+   Keys are processed in groups of DT_PREFETCH_GROUP: the whole group is hashed and the
+   primary buckets prefetched (see lb_prefetch_bucket) before any of them is probed, so
+   the cache misses of a group overlap instead of being paid one after another. Keys
+   missing from their current primary bucket then go through the ordinary lookups of the
+   older primary buckets (if the table grew) and of the secondary table.
+*/
+size_t dt_lookup_batch(dt_t *dt, const void *keys, size_t n, void *values_out, uint8_t *found_out) {
+    lb_table_t *t = &dt->primary;
+    uint32_t buckets[DT_PREFETCH_GROUP];
+    size_t hits = 0;
+    for (size_t g = 0; g < n; g += DT_PREFETCH_GROUP) {
+        size_t m = n - g < DT_PREFETCH_GROUP ? n - g : DT_PREFETCH_GROUP;
+        for (size_t i = 0; i < m; i++) {
+            const char *key = (const char *)keys + (g + i) * t->key_size;
+            buckets[i] = lb_bucket_of(t, hash_key(key, t->key_size, PRIMARY_SEED));
+            lb_prefetch_bucket(t, buckets[i]);
+        }
+        for (size_t i = 0; i < m; i++) {
+            const char *key = (const char *)keys + (g + i) * t->key_size;
+            char *value = values_out ? (char *)values_out + (g + i) * t->value_size : NULL;
+            int found = lb_lookup_bucket(t, buckets[i], key, value) ||
+                        lb_lookup_older(t, key, PRIMARY_SEED, buckets[i], value) ||
+                        lb_lookup(&dt->secondary, key, SECONDARY_SEED, value);
+            if (found_out)
+                found_out[g + i] = (uint8_t)found;
+            hits += found;
+        }
+    }
+    return hits;
+}
+
+/* Interleaved lookups (AMAC: asynchronous memory access chaining).
+   Each in-flight lookup is a tiny state machine that prefetches the bucket it needs next
+   and yields; a round-robin scheduler resumes it once the others have had their turn, by
+   which time the lines have usually arrived. Unlike the fixed groups of dt_lookup_batch,
+   a lookup that misses the primary table simply takes another step for the secondary
+   while its neighbours move on, and a finished lookup's place is refilled at once.
+*/
+enum { DT_STEP_PRIMARY, DT_STEP_SECONDARY, DT_STEP_IDLE };
+
+typedef struct {
+    size_t index;               // which key this lookup is working on
+    uint32_t bucket;            // bucket prefetched for the next step
+    uint8_t step;               // DT_STEP_*
+} dt_inflight_t;
+
+static inline void dt_inflight_start(dt_t *dt, const void *keys, dt_inflight_t *f, size_t index) {
+    const char *key = (const char *)keys + index * dt->primary.key_size;
+    f->index = index;
+    f->bucket = lb_bucket_of(&dt->primary, hash_key(key, dt->primary.key_size, PRIMARY_SEED));
+    f->step = DT_STEP_PRIMARY;
+    lb_prefetch_bucket(&dt->primary, f->bucket);
+}
+
+/* dt_lookup_interleaved has the same contract as dt_lookup_batch, but keeps DT_INFLIGHT
+   lookups interleaved (see above) instead of working in lockstep groups.
+*/
+size_t dt_lookup_interleaved(dt_t *dt, const void *keys, size_t n, void *values_out, uint8_t *found_out) {
+    dt_inflight_t flight[DT_INFLIGHT];
+    size_t next = 0, hits = 0;
+    unsigned active = 0;
+    for (unsigned i = 0; i < DT_INFLIGHT; i++) {
+        flight[i].step = DT_STEP_IDLE;
+        if (next < n) {
+            dt_inflight_start(dt, keys, &flight[i], next++);
+            active++;
+        }
+    }
+    while (active) {
+        for (unsigned i = 0; i < DT_INFLIGHT; i++) {
+            dt_inflight_t *f = &flight[i];
+            if (f->step == DT_STEP_IDLE) continue;
+            const char *key = (const char *)keys + f->index * dt->primary.key_size;
+            char *value = values_out ? (char *)values_out + f->index * dt->primary.value_size : NULL;
+            int found;
+            if (f->step == DT_STEP_PRIMARY) {
+                found = lb_lookup_bucket(&dt->primary, f->bucket, key, value) ||
+                        lb_lookup_older(&dt->primary, key, PRIMARY_SEED, f->bucket, value);
+                if (!found) {
+                    uint32_t hash = hash_key(key, dt->secondary.key_size, SECONDARY_SEED);
+                    f->bucket = lb_bucket_of(&dt->secondary, hash);
+                    f->step = DT_STEP_SECONDARY;
+                    lb_prefetch_bucket(&dt->secondary, f->bucket);
+                    continue;
+                }
+            } else {
+                found = lb_lookup_bucket(&dt->secondary, f->bucket, key, value);
+            }
+            if (found_out)
+                found_out[f->index] = (uint8_t)found;
+            hits += found;
+            if (next < n) {
+                dt_inflight_start(dt, keys, f, next++);
+            } else {
+                f->step = DT_STEP_IDLE;
+                active--;
+            }
+        }
+    }
+    return hits;
+}
+
+/* Single-probe upserts.
+   dt_upsert_impl locks every stripe of the key's history (see Key history), primary and
+   then secondary, each in ascending stripe order (so two upserts cannot deadlock), and
+   searches the history for the key: the current bucket with lb_probe, which also notes
+   its first free slot, and the older ones with lb_find. If the key is absent it goes into
+   the remembered slot: primary first, and following the same growth order as dt_insert
+   (grow the primary, then use the secondary, then grow the secondary) when the primary
+   bucket is full.
+   Every history starts with the bucket under the initial geometry, so upserts of one key
+   always share a stripe, and an upsert that finds the geometry changed once it holds its
+   stripes starts over; so upserts never create duplicates of each other. Plain dt_insert
+   takes no stripe and can still add a second copy.
+*/
+enum { DT_UPSERT_REPLACE, DT_UPSERT_KEEP };
+
+/* lb_probe_history looks for key in every bucket of h (the current one brought up to date
+   and probed first) and stores the slot and bucket of a match. *free_out is the current
+   bucket's first free slot, as from lb_probe. The caller holds h->stripes.
+*/
+static int lb_probe_history(lb_table_t *t, const lb_history_t *h, const void *key,
+                            uint32_t *pos_out, uint32_t *bucket_out, uint32_t *free_out) {
+    uint32_t i = h->n - 1;
+    lb_touch_locked(t, h->buckets[i]);
+    if (!lb_probe(t, h->buckets[i], key, pos_out, free_out)) {
+        while (i-- > 0 && !lb_find(t, h->buckets[i], key, pos_out))
+            ;
+        if (i == UINT32_MAX) return 0;
+    }
+    *bucket_out = h->buckets[i];
+    return 1;
+}
+
+static int dt_upsert_impl(dt_t *dt, const void *key, const void *value, int mode, void **value_out) {
+    lb_table_t *p = &dt->primary, *s = &dt->secondary;
+    uint32_t hp = hash_key(key, p->key_size, PRIMARY_SEED);
+    uint32_t hs = hash_key(key, s->key_size, SECONDARY_SEED);
+    int grew_p = 0, grew_s = 0;
+    for (;;) {
+        lb_geometry_t gp = lb_geometry(p), gs = lb_geometry(s);
+        lb_history_t history_p, history_s;
+        lb_history(p, hp, gp, &history_p);
+        lb_history(s, hs, gs, &history_s);
+        uint32_t bp = history_p.buckets[history_p.n - 1], bs = history_s.buckets[history_s.n - 1];
+        uint32_t pos, bucket, free_p, free_s = UINT32_MAX;
+        lb_table_t *t = NULL;
+        int result = 0;
+        lb_lock_stripes(p, history_p.stripes);
+        lb_lock_stripes(s, history_s.stripes);
+        if (lb_geometry(p).word != gp.word || lb_geometry(s).word != gs.word) {
+            lb_unlock_stripes(s, history_s.stripes); // grown meanwhile: the key may be in a
+            lb_unlock_stripes(p, history_p.stripes); // bucket this history does not cover
+            continue;
+        }
+        if (lb_probe_history(p, &history_p, key, &pos, &bucket, &free_p))
+            t = p;
+        else if (lb_probe_history(s, &history_s, key, &pos, &bucket, &free_s))
+            t = s;
+        if (t) {
+            if (mode == DT_UPSERT_REPLACE) {
+                lb_write_begin(t, bucket);
+                memcpy(lb_values(t) + (size_t)pos * t->value_size, value, t->value_size);
+                lb_write_end(t, bucket);
+            }
+            result = 2;
+        } else {
+            if (free_p != UINT32_MAX && lb_claim_at(p, bp, free_p, &pos))
+                t = p;
+            else if (grew_p && free_s != UINT32_MAX && lb_claim_at(s, bs, free_s, &pos))
+                t = s;
+            if (t) {
+                memcpy(lb_keys(t) + (size_t)pos * t->key_size, key, t->key_size);
+                memcpy(lb_values(t) + (size_t)pos * t->value_size, value, t->value_size);
+                lb_publish(t, pos);
+                result = 1;
+            }
+        }
+        if (result && value_out)
+            *value_out = lb_values(t) + (size_t)pos * t->value_size;
+        lb_unlock_stripes(s, history_s.stripes);
+        lb_unlock_stripes(p, history_p.stripes);
+        if (result) return result;
+        if (!grew_p) {
+            grew_p = 1;
+            lb_grow(p, gp.count);
+        } else if (!grew_s) {
+            grew_s = 1;
+            if (!lb_grow(s, gs.count)) return 0;
+        } else {
+            return 0;
+        }
+    }
+}
+
+/* dt_upsert stores value under key, replacing the value if the key is present.
+   Returns 1 if the key was inserted, 2 if its value was replaced, 0 if the table is full.
+*/
+int dt_upsert(dt_t *dt, const void *key, const void *value) {
+    return dt_upsert_impl(dt, key, value, DT_UPSERT_REPLACE, NULL);
+}
+
+/* dt_get_or_insert returns a pointer to the value stored under key, inserting value first
+   if the key is absent (*inserted_out, if non-NULL, tells which). Returns NULL if the
+   table is full. The pointer stays valid until the key is deleted (see dt_deref).
+*/
+void *dt_get_or_insert(dt_t *dt, const void *key, const void *value, int *inserted_out) {
+    void *ref = NULL;
+    int result = dt_upsert_impl(dt, key, value, DT_UPSERT_KEEP, &ref);
+    if (inserted_out)
+        *inserted_out = result == 1;
+    return ref;
+}
+
+/* dt_insert_unique inserts key only if it is absent.
+   Returns 1 if inserted, 0 if the key was already present, -1 if the table is full.
+*/
+int dt_insert_unique(dt_t *dt, const void *key, const void *value) {
+    int result = dt_upsert_impl(dt, key, value, DT_UPSERT_KEEP, NULL);
+    return result == 2 ? 0 : result == 1 ? 1 : -1;
+}
+
+/* dt_sort_by_bucket orders the m indices in order by their bucket (insertion sort; m is
+   at most DT_PREFETCH_GROUP), so that keys sharing a bucket form one run.
+*/
+static void dt_sort_by_bucket(uint32_t *order, const uint32_t *buckets, size_t m) {
+    for (size_t i = 1; i < m; i++) {
+        uint32_t o = order[i];
+        size_t j = i;
+        for (; j > 0 && buckets[order[j - 1]] > buckets[o]; j--)
+            order[j] = order[j - 1];
+        order[j] = o;
+    }
+}
+
+/* dt_insert_spill is the rest of a batched insert whose primary bucket was full: the same
+   grow-then-secondary sequence as dt_insert. seen is the primary count the key's group was
+   placed under, so only the first key of a group to overflow grows the table; the others
+   find it grown already and just retry.
+*/
+static int dt_insert_spill(dt_t *dt, const void *key, const void *value, uint32_t seen) {
+    uint32_t bucket;
+    uint8_t slot;
+    if (lb_grow(&dt->primary, seen) &&
+        lb_insert(&dt->primary, key, value, PRIMARY_SEED, NULL, 0, &bucket, &slot))
+        return 1;
+    return lb_insert_grow(&dt->secondary, key, value, SECONDARY_SEED, NULL, 0, &bucket, &slot);
+}
+
+/* dt_insert_batch inserts n key/value pairs stored back to back in keys and values;
+   ok_out[i] (if non-NULL) tells whether pair i went in. Returns the number inserted.
+   Before anything is placed the primary table is grown once to hold at least n slots
+   (lb_reserve), instead of doubling repeatedly as single inserts overflow. Each group of
+   DT_PREFETCH_GROUP keys is then hashed under one geometry snapshot, its primary stamps
+   and bitmap words prefetched, and the keys sorted by bucket: every run of keys sharing a
+   bucket is brought up to date once and gets its slots from one load and CAS per bitmap
+   word (lb_claim_many). Keys that do not fit go through dt_insert_spill, which grows the
+   table at most once per group.
+*/
+size_t dt_insert_batch(dt_t *dt, const void *keys, const void *values, size_t n, uint8_t *ok_out) {
+    lb_table_t *t = &dt->primary;
+    uint32_t buckets[DT_PREFETCH_GROUP], order[DT_PREFETCH_GROUP], pos[DT_PREFETCH_GROUP];
+    size_t inserted = 0;
+    lb_reserve(t, n);
+    for (size_t g = 0; g < n; g += DT_PREFETCH_GROUP) {
+        size_t m = n - g < DT_PREFETCH_GROUP ? n - g : DT_PREFETCH_GROUP;
+        lb_geometry_t geo = lb_geometry(t);
+        for (size_t i = 0; i < m; i++) {
+            const char *key = (const char *)keys + (g + i) * t->key_size;
+            uint32_t bucket = hash_key(key, t->key_size, PRIMARY_SEED) % geo.num_buckets;
+            uint32_t base = bucket * t->slots_per_bucket;
+            __builtin_prefetch(&lb_gen(t)[bucket]);
+            for (uint32_t w = base / 64; w * 64 < base + t->slots_per_bucket; w++)
+                __builtin_prefetch(&lb_bitmap(t)[w], 1);
+            buckets[i] = bucket;
+            order[i] = (uint32_t)i;
+        }
+        dt_sort_by_bucket(order, buckets, m);
+        for (size_t r = 0; r < m;) {
+            uint32_t bucket = buckets[order[r]];
+            size_t e = r + 1;
+            while (e < m && buckets[order[e]] == bucket)
+                e++;
+            lb_touch(t, bucket);
+            uint32_t got = lb_claim_many(t, bucket, (uint32_t)(e - r), pos);
+            for (size_t j = r; j < e; j++) {
+                size_t i = g + order[j];
+                const char *key = (const char *)keys + i * t->key_size;
+                const char *value = (const char *)values + i * t->value_size;
+                int ok = 1;
+                if (j - r < got) {
+                    memcpy(lb_keys(t) + (size_t)pos[j - r] * t->key_size, key, t->key_size);
+                    memcpy(lb_values(t) + (size_t)pos[j - r] * t->value_size, value, t->value_size);
+                    lb_publish(t, pos[j - r]);
+                } else {
+                    ok = dt_insert_spill(dt, key, value, geo.count);
+                }
+                if (ok_out)
+                    ok_out[i] = (uint8_t)ok;
+                inserted += ok;
+            }
+            r = e;
+        }
+    }
+    return inserted;
+}
+
+/* dt_take_batch removes n keys stored back to back in keys, copying the value of key i to
+   the i-th value_size slot of values_out (if non-NULL); found_out[i] (if non-NULL) tells
+   whether key i was present. Returns the number removed. dt_delete_batch is the same
+   without the copies.
+   Grouped like dt_insert_batch: each run of keys sharing a primary bucket is handled under
+   one acquisition of the bucket's stripe and one sequence-counter bump. Keys not found in
+   their current primary bucket are then removed one by one with dt_take's probes, which
+   also cover the older buckets of a grown table.
+*/
+size_t dt_take_batch(dt_t *dt, const void *keys, size_t n, void *values_out, uint8_t *found_out) {
+    lb_table_t *t = &dt->primary;
+    uint32_t buckets[DT_PREFETCH_GROUP], order[DT_PREFETCH_GROUP], pos[DT_PREFETCH_GROUP];
+    uint8_t hit[DT_PREFETCH_GROUP];
+    size_t deleted = 0;
+    for (size_t g = 0; g < n; g += DT_PREFETCH_GROUP) {
+        size_t m = n - g < DT_PREFETCH_GROUP ? n - g : DT_PREFETCH_GROUP;
+        int grown = lb_geometry(t).count != t->initial_count;
+        for (size_t i = 0; i < m; i++) {
+            const char *key = (const char *)keys + (g + i) * t->key_size;
+            buckets[i] = lb_bucket_of(t, hash_key(key, t->key_size, PRIMARY_SEED));
+            lb_prefetch_bucket(t, buckets[i]);
+            order[i] = (uint32_t)i;
+        }
+        dt_sort_by_bucket(order, buckets, m);
+        for (size_t r = 0; r < m;) {
+            uint32_t bucket = buckets[order[r]];
+            size_t e = r + 1;
+            while (e < m && buckets[order[e]] == bucket)
+                e++;
+            if (t->locks_off) spin_lock(LB_STRIPE(t, bucket));
+            lb_write_begin(t, bucket);
+            for (size_t j = r; j < e; j++) {
+                const char *key = (const char *)keys + (g + order[j]) * t->key_size;
+                hit[order[j]] = (uint8_t)lb_find(t, bucket, key, &pos[order[j]]);
+                if (!hit[order[j]]) continue;
+                if (values_out)
+                    memcpy((char *)values_out + (g + order[j]) * t->value_size,
+                           lb_values(t) + (size_t)pos[order[j]] * t->value_size, t->value_size);
+                lb_unpublish(t, pos[order[j]]);
+                if (!dt->readers_off) // unpublishing did nothing; free now so a repeat of key misses
+                    lb_release(t, pos[order[j]]);
+            }
+            lb_write_end(t, bucket);
+            lb_unlock_bucket(t, bucket);
+            r = e;
+        }
+        for (size_t i = 0; i < m; i++) {
+            const char *key = (const char *)keys + (g + i) * t->key_size;
+            char *value = values_out ? (char *)values_out + (g + i) * t->value_size : NULL;
+            uint32_t p;
+            int found = 1;
+            if (hit[i]) {
+                if (dt->readers_off)
+                    dt_release(dt, 0, pos[i]);
+            } else if (grown && lb_delete(t, key, PRIMARY_SEED, value, &p)) {
+                dt_release(dt, 0, p);
+            } else if (lb_delete(&dt->secondary, key, SECONDARY_SEED, value, &p)) {
+                dt_release(dt, 1, p);
+            } else {
+                found = 0;
+            }
+            if (found_out)
+                found_out[g + i] = (uint8_t)found;
+            deleted += found;
+        }
+    }
+    return deleted;
+}
+
+size_t dt_delete_batch(dt_t *dt, const void *keys, size_t n, uint8_t *found_out) {
+    return dt_take_batch(dt, keys, n, NULL, found_out);
+}
+
+/* dt_take removes key and copies its value to value_out (if non-NULL) in the same probe,
+   instead of a dt_lookup followed by a dt_delete. Returns 1 if found, 0 otherwise.
+*/
+int dt_take(dt_t *dt, const void *key, void *value_out) {
+    uint32_t pos;
+    if (lb_delete(&dt->primary, key, PRIMARY_SEED, value_out, &pos)) {
+        dt_release(dt, 0, pos);
+        return 1;
+    }
+    if (lb_delete(&dt->secondary, key, SECONDARY_SEED, value_out, &pos)) {
+        dt_release(dt, 1, pos);
+        return 1;
+    }
+    return 0;
+}
+
+int dt_delete(dt_t *dt, const void *key) {
+    return dt_take(dt, key, NULL);
+}
+
+/* Atomic updates of 8-byte values (value_size must be 8; otherwise both report the key
+   as absent). They modify the value in place, see lb_rmw, and are atomic with respect to
+   each other, dt_lookup, dt_delete and dt_upsert in concurrent tables.
+   dt_cas stores desired if the value equals *expected and returns 1; otherwise it returns
+   0 and leaves the current value in *expected. Returns -1 if key is absent.
+   dt_fetch_add adds delta (wrapping) and stores the previous value in *old_out (if
+   non-NULL). Returns 1, or 0 if key is absent.
+*/
+static int dt_rmw(dt_t *dt, const void *key, int op, uint64_t *word, uint64_t arg) {
+    if (dt->primary.value_size != sizeof(uint64_t)) return -1;
+    int result = lb_rmw(&dt->primary, key, PRIMARY_SEED, op, word, arg);
+    return result >= 0 ? result : lb_rmw(&dt->secondary, key, SECONDARY_SEED, op, word, arg);
+}
+
+int dt_cas(dt_t *dt, const void *key, uint64_t *expected, uint64_t desired) {
+    return dt_rmw(dt, key, LB_RMW_CAS, expected, desired);
+}
+
+int dt_fetch_add(dt_t *dt, const void *key, uint64_t delta, uint64_t *old_out) {
+    uint64_t old;
+    int result = dt_rmw(dt, key, LB_RMW_ADD, &old, delta);
+    if (result > 0 && old_out)
+        *old_out = old;
+    return result > 0;
+}
+
+#ifdef DT_WIPE_ON_DELETE
+/* dt_wipe_job zeroes this worker's share of the active key and value ranges of both tables.
+   The range covers every slot of every active bucket, which can exceed count: a bucket
+   holds slots_per_bucket slots even while count is smaller.
+*/
+static void dt_wipe_job(void *ctx, unsigned worker, unsigned num_workers) {
+    dt_t *dt = ctx;
+    for (int i = 0; i < 2; i++) {
+        lb_table_t *t = i ? &dt->secondary : &dt->primary;
+        lb_geometry_t g = lb_geometry(t);
+        uint64_t slots = (uint64_t)g.num_buckets * t->slots_per_bucket;
+        uint64_t begin, end;
+        if (slots < g.count) slots = g.count;
+        dt_split(slots, worker, num_workers, &begin, &end);
+        memset(lb_keys(t) + begin * t->key_size, 0, (end - begin) * t->key_size);
+        memset(lb_values(t) + begin * t->value_size, 0, (end - begin) * t->value_size);
+    }
+}
+#endif
+
+/* dt_reset empties both tables in constant time: it only shrinks the active capacity back
+   to the initial capacity and advances each table's epoch (see lb_reset). Keys, values and
+   bitmap bits are left in place and are reclaimed lazily as buckets are touched again.
+   With DT_WIPE_ON_DELETE the active key/value ranges are scrubbed first, which costs O(active),
+   split across the table's workers.
+   In concurrent tables every stripe of both tables is held for the duration, and slots
+   still waiting for readers are dropped from the retire ring along with everything else.
+*/
+void dt_reset(dt_t *dt) {
+    lb_lock_all(&dt->primary);
+    lb_lock_all(&dt->secondary);
+#ifdef DT_WIPE_ON_DELETE
+    dt_workers_run(dt->workers, dt_wipe_job, dt);
+#endif
+    lb_reset(&dt->primary);
+    lb_reset(&dt->secondary);
+    dt->retire_tail = dt->retire_head; // retired slots sit in buckets the reset just made stale
+    dt->overflow_open = dt->overflow_sealed = 0;
+    lb_unlock_all(&dt->secondary);
+    lb_unlock_all(&dt->primary);
+}
+
+/* lb_count_range counts the published entries in buckets [begin, end) of t. */
+static uint64_t lb_count_range(lb_table_t *t, uint32_t begin, uint32_t end) {
+    uint64_t n = 0;
+    for (uint32_t bucket = begin; bucket < end; bucket++) {
+        if (!BUCKET_LIVE(t, bucket)) continue;
+        uint32_t base = bucket * t->slots_per_bucket;
+        uint32_t stop = base + t->slots_per_bucket;
+        for (uint32_t w = base / 64; w * 64 < stop; w++) {
+            uint64_t ready = __atomic_load_n(&lb_ready(t)[w], __ATOMIC_ACQUIRE);
+            n += __builtin_popcountll(ready & bitmap_mask(w, base, stop));
+        }
+    }
+    return n;
+}
+
+typedef struct {
+    dt_t *dt;
+    lb_geometry_t geometry[2];
+    uint64_t partial[DT_MAX_WORKERS];
+} dt_count_job_t;
+
+static void dt_count_job(void *ctx, unsigned worker, unsigned num_workers) {
+    dt_count_job_t *job = ctx;
+    uint64_t n = 0;
+    for (int i = 0; i < 2; i++) {
+        uint64_t begin, end;
+        dt_split(job->geometry[i].num_buckets, worker, num_workers, &begin, &end);
+        n += lb_count_range(i ? &job->dt->secondary : &job->dt->primary, (uint32_t)begin, (uint32_t)end);
+    }
+    job->partial[worker] = n;
+}
+
+/* Iteration.
+   The active buckets of both tables are cut into chunks of about DT_CHUNK_SLOTS slots,
+   numbered primary first. Each worker starts with an even, contiguous run of chunks and
+   takes them one at a time from the front through an atomic cursor; once its own run is
+   used up it moves on to the other workers' cursors in turn and takes chunks from them the
+   same way, so a worker that drew dense or slow chunks is helped instead of waited for.
+*/
+typedef struct {
+    dt_t *dt;
+    dt_entry_fn fn;
+    void *ctx;
+    lb_geometry_t geometry[2];
+    uint32_t chunk_buckets[2];  // buckets per chunk in each table
+    uint64_t chunks[2];         // chunks in each table
+    unsigned workers;           // cursors in use (a nested run drains them all on one worker)
+    struct {
+        _Alignas(DT_ALIGN) uint64_t next; // next chunk to take (may run past end)
+        uint64_t end;
+    } cursor[DT_MAX_WORKERS];
+} dt_for_each_job_t;
+
+/* dt_visit_chunk calls fn on every published entry in chunk c. */
+static void dt_visit_chunk(dt_for_each_job_t *job, uint64_t c) {
+    int i = c >= job->chunks[0];
+    lb_table_t *t = i ? &job->dt->secondary : &job->dt->primary;
+    uint64_t first = (i ? c - job->chunks[0] : c) * job->chunk_buckets[i];
+    uint64_t last = first + job->chunk_buckets[i];
+    if (last > job->geometry[i].num_buckets) last = job->geometry[i].num_buckets;
+    for (uint32_t bucket = (uint32_t)first; bucket < last; bucket++) {
+        if (!BUCKET_LIVE(t, bucket)) continue;
+        uint32_t base = bucket * t->slots_per_bucket;
+        uint32_t end = base + t->slots_per_bucket;
+        for (uint32_t w = base / 64; w * 64 < end; w++) {
+            uint64_t bits = __atomic_load_n(&lb_ready(t)[w], __ATOMIC_ACQUIRE) & bitmap_mask(w, base, end);
+            while (bits) {
+                uint32_t pos = w * 64 + __builtin_ctzll(bits);
+                job->fn(job->ctx, lb_keys(t) + (size_t)pos * t->key_size,
+                        lb_values(t) + (size_t)pos * t->value_size);
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+static void dt_for_each_job(void *ctx, unsigned worker, unsigned num_workers) {
+    dt_for_each_job_t *job = ctx;
+    for (unsigned k = 0; k < job->workers; k++) {
+        unsigned victim = (worker + k) % job->workers;
+        for (;;) {
+            uint64_t c = __atomic_fetch_add(&job->cursor[victim].next, 1, __ATOMIC_RELAXED);
+            if (c >= job->cursor[victim].end) break;
+            dt_visit_chunk(job, c);
+        }
+    }
+}
+
+static void dt_for_each_run(dt_t *dt, dt_workers_t *workers, dt_entry_fn fn, void *ctx) {
+    dt_for_each_job_t job;
+    unsigned n = workers ? workers->num_workers : 1;
+    job.dt = dt;
+    job.fn = fn;
+    job.ctx = ctx;
+    for (int i = 0; i < 2; i++) {
+        lb_table_t *t = i ? &dt->secondary : &dt->primary;
+        job.geometry[i] = lb_geometry(t);
+        uint32_t chunk = DT_CHUNK_SLOTS / t->slots_per_bucket;
+        job.chunk_buckets[i] = chunk ? chunk : 1;
+        job.chunks[i] = (job.geometry[i].num_buckets + job.chunk_buckets[i] - 1) / job.chunk_buckets[i];
+    }
+    job.workers = n;
+    for (unsigned i = 0; i < n; i++)
+        dt_split(job.chunks[0] + job.chunks[1], i, n, &job.cursor[i].next, &job.cursor[i].end);
+    int reader;
+    while ((reader = dt_read_begin(dt)) < 0)
+        CPU_RELAX();
+    dt_workers_run(workers, dt_for_each_job, &job);
+    dt_read_end(dt, reader);
+}
+
+/* dt_for_each calls fn(ctx, key, value) once for every entry, on the calling thread.
+   dt_parallel_for_each does the same across the table's workers (see Iteration above), so
+   fn must be thread-safe; the order of calls is unspecified either way.
+   fn may modify the value in place but must not insert into or delete from the table.
+   In concurrent tables the iteration runs inside a read section: entries inserted or
+   deleted meanwhile may or may not be visited, but every pointer handed to fn stays valid
+   until the iteration returns.
+*/
+void dt_for_each(dt_t *dt, dt_entry_fn fn, void *ctx) {
+    dt_for_each_run(dt, NULL, fn, ctx);
+}
+
+void dt_parallel_for_each(dt_t *dt, dt_entry_fn fn, void *ctx) {
+    dt_for_each_run(dt, dt->workers, fn, ctx);
+}
+
+/* dt_count returns the number of entries in the table by scanning every active bucket,
+   split across the table's workers. Concurrent writers may or may not be counted.
+*/
+uint64_t dt_count(dt_t *dt) {
+    dt_count_job_t job;
+    job.dt = dt;
+    job.geometry[0] = lb_geometry(&dt->primary);
+    job.geometry[1] = lb_geometry(&dt->secondary);
+    unsigned workers = dt_workers_run(dt->workers, dt_count_job, &job);
+    uint64_t n = 0;
+    for (unsigned i = 0; i < workers; i++)
+        n += job.partial[i];
+    return n;
+}
+
+/*-------------------------------------------------------------------------
+   Bulk Build
+-------------------------------------------------------------------------*/
+
+/* dt_build fills one level at a time. A level is sized once for everything it will be
+   asked to hold, and is never grown afterwards. Growing would move entries to other
+   buckets after they are placed.
+   1. hash: every pair's bucket under the final geometry (split across workers);
+   2. partition: a counting sort of pair indices by bucket (histogram, prefix sum, scatter);
+   3. fill: each bucket's pairs are copied into its slots front to back and the bucket's
+      bitmap bits and stamp are written once (split across workers by bucket range);
+   4. spill: the pairs beyond a bucket's capacity are collected, in bucket order, and all
+      handed to the next level together.
+*/
+typedef struct {
+    lb_table_t *t;
+    uint32_t seed;
+    const char *keys;
+    const char *values;
+    const uint32_t *input;      // pair indices to place (NULL = 0..m-1)
+    size_t m;
+    uint32_t num_buckets;
+    uint32_t *bucket;           // bucket of input[i]
+    uint32_t *start;            // bucket b's pairs are order[start[b] .. start[b + 1])
+    uint32_t *order;            // pair indices grouped by bucket
+} dt_build_job_t;
+
+#define DT_BUILD_INDEX(job, i) ((job)->input ? (job)->input[i] : (uint32_t)(i))
+
+static void dt_build_hash_job(void *ctx, unsigned worker, unsigned num_workers) {
+    dt_build_job_t *job = ctx;
+    uint64_t begin, end;
+    dt_split(job->m, worker, num_workers, &begin, &end);
+    for (uint64_t i = begin; i < end; i++) {
+        const char *key = job->keys + (size_t)DT_BUILD_INDEX(job, i) * job->t->key_size;
+        job->bucket[i] = hash_key(key, job->t->key_size, job->seed) % job->num_buckets;
+    }
+}
+
+static void dt_build_fill_job(void *ctx, unsigned worker, unsigned num_workers) {
+    dt_build_job_t *job = ctx;
+    lb_table_t *t = job->t;
+    uint64_t begin, end;
+    dt_split(job->num_buckets, worker, num_workers, &begin, &end);
+    for (uint32_t b = (uint32_t)begin; b < end; b++) {
+        uint32_t count = job->start[b + 1] - job->start[b];
+        if (!count) continue; // stays stale, i.e. empty
+        uint32_t k = count < t->slots_per_bucket ? count : t->slots_per_bucket;
+        uint32_t base = b * t->slots_per_bucket;
+        for (uint32_t j = 0; j < k; j++) {
+            uint32_t idx = job->order[job->start[b] + j];
+            memcpy(lb_keys(t) + (size_t)(base + j) * t->key_size,
+                   job->keys + (size_t)idx * t->key_size, t->key_size);
+            memcpy(lb_values(t) + (size_t)(base + j) * t->value_size,
+                   job->values + (size_t)idx * t->value_size, t->value_size);
+        }
+        bitmap_clear_range(lb_bitmap(t), base, t->slots_per_bucket, 1);
+        bitmap_set_range(lb_bitmap(t), base, k);
+        if (t->ready_off != t->bitmap_off) {
+            bitmap_clear_range(lb_ready(t), base, t->slots_per_bucket, 1);
+            bitmap_set_range(lb_ready(t), base, k);
+        }
+        __atomic_store_n(&lb_gen(t)[b], t->epoch, __ATOMIC_RELEASE);
+    }
+}
+
+/* dt_build_level places the m pairs named by input into the empty table t, after growing
+   it to at least reserve slots. The indices of the pairs that did not fit are written to
+   spill and counted in *spilled. Returns 0 if scratch memory cannot be mapped.
+*/
+static int dt_build_level(dt_t *dt, lb_table_t *t, uint32_t seed, const char *keys, const char *values,
+                          const uint32_t *input, size_t m, uint64_t reserve,
+                          uint32_t *spill, size_t *spilled) {
+    dt_build_job_t job;
+    *spilled = 0;
+    if (!m) return 1;
+    lb_reserve(t, reserve);
+    job.t = t;
+    job.seed = seed;
+    job.keys = keys;
+    job.values = values;
+    job.input = input;
+    job.m = m;
+    job.num_buckets = lb_geometry(t).num_buckets;
+    size_t bytes = 2 * m * sizeof(uint32_t) + ((size_t)job.num_buckets + 1) * sizeof(uint32_t);
+    char *scratch = xmap(bytes);
+    if (!scratch) return 0;
+    job.bucket = (uint32_t *)scratch;
+    job.order = job.bucket + m;
+    job.start = job.order + m;
+    dt_workers_run(dt->workers, dt_build_hash_job, &job);
+    for (size_t i = 0; i < m; i++)
+        job.start[job.bucket[i] + 1]++;
+    for (uint32_t b = 0; b < job.num_buckets; b++)
+        job.start[b + 1] += job.start[b];
+    for (size_t i = 0; i < m; i++)
+        job.order[job.start[job.bucket[i]]++] = DT_BUILD_INDEX(&job, i);
+    for (uint32_t b = job.num_buckets; b > 0; b--) // the scatter left start[b] at bucket b's end
+        job.start[b] = job.start[b - 1];
+    job.start[0] = 0;
+    dt_workers_run(dt->workers, dt_build_fill_job, &job);
+    for (uint32_t b = 0; b < job.num_buckets; b++)
+        for (uint32_t j = job.start[b] + t->slots_per_bucket; j < job.start[b + 1]; j++)
+            spill[(*spilled)++] = job.order[j];
+    munmap(scratch, bytes);
+    return 1;
+}
+
+/* dt_build replaces the contents of dt with the n pairs stored back to back in keys and
+   values, and returns how many were placed (less than n only if the reserved capacity
+   runs out, or 0 if scratch memory cannot be mapped). The primary table is sized for
+   n + n/4 slots up front. The pairs that overflow their primary bucket are placed in the
+   secondary table together, sized for four times their number; should any of those
+   overflow in turn, the secondary level is emptied and rebuilt at twice the size.
+   The hash and fill passes run on the table's workers. dt_build must not overlap other
+   operations on dt.
+*/
+size_t dt_build(dt_t *dt, const void *keys, const void *values, size_t n) {
+    if (n > UINT32_MAX) return 0;
+    dt_reset(dt);
+    if (!n) return 0;
+    size_t bytes = 2 * n * sizeof(uint32_t), spilled, failed = 0;
+    uint32_t *spill = xmap(bytes); // primary spills, then secondary failures
+    if (!spill) return 0;
+    int ok = dt_build_level(dt, &dt->primary, PRIMARY_SEED, keys, values, NULL, n, n + n / 4,
+                            spill, &spilled);
+    uint64_t reserve = 4 * (uint64_t)spilled;
+    while (ok) {
+        ok = dt_build_level(dt, &dt->secondary, SECONDARY_SEED, keys, values, spill, spilled, reserve,
+                            spill + n, &failed);
+        if (!failed || lb_geometry(&dt->secondary).count >= dt->secondary.max_count) break;
+        lb_lock_all(&dt->secondary);
+        lb_reset(&dt->secondary);
+        lb_unlock_all(&dt->secondary);
+        reserve *= 2;
+    }
+    munmap(spill, bytes);
+    return ok ? n - failed : 0;
+}
+
+/*-------------------------------------------------------------------------
+   Ingest Queue (dt_ingest_t)
+-------------------------------------------------------------------------*/
+
+enum { DT_INGEST_INSERT = 1, DT_INGEST_DELETE };
+
+#define DT_RING_ENTRY(q, r, i) ((r)->entries + (size_t)((i) & (DT_INGEST_RING - 1)) * (q)->entry_size)
+
+/* dt_ingest_create maps the queue header, one ring per producer and the applier's staging
+   arrays in one region. Returns NULL if num_producers is 0 or the mapping fails.
+*/
+dt_ingest_t *dt_ingest_create(dt_t *dt, uint32_t num_producers) {
+    if (!num_producers) return NULL;
+    lb_table_t *t = &dt->primary;
+    uint32_t entry_size = (uint32_t)ALIGN_UP(sizeof(dt_ingest_op_t) + t->key_size + t->value_size, 8);
+    size_t header = ALIGN_UP(sizeof(dt_ingest_t) + num_producers * sizeof(dt_ring_t), DT_ALIGN);
+    size_t ring = ALIGN_UP((size_t)DT_INGEST_RING * entry_size, DT_ALIGN);
+    size_t keys = ALIGN_UP(DT_INGEST_BATCH * t->key_size, DT_ALIGN);
+    size_t values = ALIGN_UP(DT_INGEST_BATCH * t->value_size, DT_ALIGN);
+    size_t staged = DT_INGEST_BATCH * sizeof(dt_ingest_op_t);
+    size_t size = header + num_producers * ring + keys + values + staged + DT_INGEST_BATCH;
+    char *base = xmap(size);
+    if (!base) return NULL;
+    dt_ingest_t *q = (dt_ingest_t *)base;
+    q->dt = dt;
+    q->num_producers = num_producers;
+    q->entry_size = entry_size;
+    q->size = size;
+    char *p = base + header;
+    for (uint32_t i = 0; i < num_producers; i++, p += ring)
+        q->rings[i].entries = p;
+    q->keys = p;
+    q->values = p + keys;
+    q->staged = (dt_ingest_op_t *)(p + keys + values);
+    q->ok = (uint8_t *)(p + keys + values + staged);
+    return q;
+}
+
+/* dt_ingest_destroy unmaps the queue; operations not yet drained are dropped without
+   their callbacks.
+*/
+void dt_ingest_destroy(dt_ingest_t *q) {
+    if (q)
+        munmap(q, q->size);
+}
+
+/* dt_ingest_push appends one operation to the producer's ring. Only that producer's thread
+   writes head, so a push is a few copies and one release store; tail is re-read only when
+   the cached copy says the ring is full. Returns 0 if it really is full.
+*/
+static int dt_ingest_push(dt_ingest_t *q, uint32_t producer, uint32_t op, const void *key,
+                          const void *value, dt_done_fn done, void *ctx) {
+    lb_table_t *t = &q->dt->primary;
+    dt_ring_t *r = &q->rings[producer];
+    uint64_t head = r->head;
+    if (head - r->tail_cache == DT_INGEST_RING) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - r->tail_cache == DT_INGEST_RING) return 0;
+    }
+    char *e = DT_RING_ENTRY(q, r, head);
+    dt_ingest_op_t *hdr = (dt_ingest_op_t *)e;
+    hdr->done = done;
+    hdr->ctx = ctx;
+    hdr->op = op;
+    memcpy(e + sizeof(dt_ingest_op_t), key, t->key_size);
+    if (value)
+        memcpy(e + sizeof(dt_ingest_op_t) + t->key_size, value, t->value_size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* dt_ingest_insert and dt_ingest_delete queue an operation on ring producer (which must be
+   used by one thread only). done(ctx, result), if given, runs on the applier once the
+   operation has been applied. Return 1 if queued, 0 if the ring is full (drain and retry).
+*/
+int dt_ingest_insert(dt_ingest_t *q, uint32_t producer, const void *key, const void *value,
+                     dt_done_fn done, void *ctx) {
+    return dt_ingest_push(q, producer, DT_INGEST_INSERT, key, value, done, ctx);
+}
+
+int dt_ingest_delete(dt_ingest_t *q, uint32_t producer, const void *key, dt_done_fn done, void *ctx) {
+    return dt_ingest_push(q, producer, DT_INGEST_DELETE, key, NULL, done, ctx);
+}
+
+/* dt_ingest_apply applies the n staged operations (all of kind op) and runs their callbacks. */
+static void dt_ingest_apply(dt_ingest_t *q, uint32_t op, uint32_t n) {
+    if (op == DT_INGEST_INSERT)
+        dt_insert_batch(q->dt, q->keys, q->values, n, q->ok);
+    else
+        dt_delete_batch(q->dt, q->keys, n, q->ok);
+    for (uint32_t i = 0; i < n; i++)
+        if (q->staged[i].done)
+            q->staged[i].done(q->staged[i].ctx, q->ok[i]);
+}
+
+/* dt_ingest_drain takes everything currently queued on every ring and applies it; call it
+   from the applier thread only. Operations are staged until DT_INGEST_BATCH have gathered
+   or the kind changes, so each producer's inserts and deletes still take effect in the
+   order it queued them. A ring's entries are released as soon as they are staged.
+   Returns the number of operations applied.
+*/
+size_t dt_ingest_drain(dt_ingest_t *q) {
+    lb_table_t *t = &q->dt->primary;
+    size_t applied = 0;
+    uint32_t n = 0, op = 0;
+    for (uint32_t p = 0; p < q->num_producers; p++) {
+        dt_ring_t *r = &q->rings[p];
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            const char *e = DT_RING_ENTRY(q, r, tail);
+            const dt_ingest_op_t *hdr = (const dt_ingest_op_t *)e;
+            if (n == DT_INGEST_BATCH || (n && hdr->op != op)) {
+                dt_ingest_apply(q, op, n);
+                applied += n;
+                n = 0;
+            }
+            op = hdr->op;
+            q->staged[n] = *hdr;
+            memcpy(q->keys + (size_t)n * t->key_size, e + sizeof(dt_ingest_op_t), t->key_size);
+            if (op == DT_INGEST_INSERT)
+                memcpy(q->values + (size_t)n * t->value_size, e + sizeof(dt_ingest_op_t) + t->key_size,
+                       t->value_size);
+            n++;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (n) {
+        dt_ingest_apply(q, op, n);
+        applied += n;
+    }
+    return applied;
+}
+
+/* dt_future_done is a dt_done_fn for a dt_future_t passed as ctx; dt_future_wait spins
+   until it has run and returns the result (someone must keep draining meanwhile).
+*/
+void dt_future_done(void *ctx, int result) {
+    dt_future_t *f = ctx;
+    f->result = result;
+    __atomic_store_n(&f->ready, 1, __ATOMIC_RELEASE);
+}
+
+int dt_future_wait(dt_future_t *f) {
+    while (!__atomic_load_n(&f->ready, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+    return f->result;
+}
+
+/*-------------------------------------------------------------------------
+   Table Pools (dt_pool_t)
+-------------------------------------------------------------------------*/
+
+/* dt_pool_create maps reserve bytes once and places the pool header at its start.
+   Tables are bump-allocated from the rest on demand (the kernel only backs the pages
+   that are actually touched). config->max_capacity is ignored; capacity comes from
+   the size class requested in dt_pool_get.
+*/
+dt_pool_t *dt_pool_create(const dt_config_t *config, size_t reserve) {
+    uint32_t class_slots[DT_POOL_CLASSES];
+    size_t class_bytes[DT_POOL_CLASSES];
+    size_t used = ALIGN_UP(sizeof(dt_pool_t), DT_ALIGN);
+    for (int c = 0; c < DT_POOL_CLASSES; c++) {
+        dt_config_t cfg = *config;
+        lb_table_t probe;
+        cfg.max_capacity = (uint32_t)DT_POOL_MIN_CAPACITY << c;
+        lb_init(&probe, &cfg, PRIMARY_BUCKET_SIZE);
+        class_slots[c] = probe.max_count;
+        class_bytes[c] = ALIGN_UP(dt_layout(NULL, &cfg), DT_ALIGN);
+    }
+    if (reserve < used + class_bytes[0]) return NULL; // not even one table of the smallest class
+    char *base = xmap(reserve);
+    if (!base) return NULL;
+    dt_pool_t *pool = (dt_pool_t *)base;
+    pool->config = *config;
+    pool->base = base;
+    pool->size = reserve;
+    pool->used = used;
+    memcpy(pool->class_slots, class_slots, sizeof(class_slots));
+    memcpy(pool->class_bytes, class_bytes, sizeof(class_bytes));
+    return pool;
+}
+
+/* dt_pool_destroy returns the whole reservation; every table obtained from the pool
+   becomes invalid.
+*/
+void dt_pool_destroy(dt_pool_t *pool) {
+    if (pool)
+        munmap(pool->base, pool->size);
+}
+
+/* dt_pool_get returns an empty table with room for at least capacity slots per
+   load-balancing table, or NULL if capacity exceeds the largest class or the
+   reservation is exhausted. A parked table of the right class is reused first (O(1)).
+*/
+dt_t *dt_pool_get(dt_pool_t *pool, uint32_t capacity) {
+    int c = 0;
+    while (c < DT_POOL_CLASSES && ((uint32_t)DT_POOL_MIN_CAPACITY << c) < capacity)
+        c++;
+    if (c == DT_POOL_CLASSES) return NULL;
+    dt_t *dt = pool->free_list[c];
+    if (dt) {
+        pool->free_list[c] = dt->base;
+        dt->base = NULL;
+        return dt;
+    }
+    if (pool->used + pool->class_bytes[c] > pool->size) return NULL;
+    dt_config_t cfg = pool->config;
+    cfg.max_capacity = (uint32_t)DT_POOL_MIN_CAPACITY << c;
+    dt = (dt_t *)(pool->base + pool->used);
+    pool->used += pool->class_bytes[c];
+    dt_layout(dt, &cfg); // fresh pool memory is still zero, so the stamps are already clear
+    return dt;
+}
+
+/* dt_pool_put parks dt on its class free list after an O(1) dt_reset.
+   The table must have come from this pool and must not be used afterwards.
+*/
+void dt_pool_put(dt_pool_t *pool, dt_t *dt) {
+    int c = 0;
+    while (c < DT_POOL_CLASSES && pool->class_slots[c] != dt->primary.max_count)
+        c++;
+    if (c == DT_POOL_CLASSES) return;
+    dt_reset(dt);
+    dt->base = pool->free_list[c];
+    pool->free_list[c] = dt;
+}
+
+/*-------------------------------------------------------------------------
+   NUMA Placement and Per-Node Replicas
+-------------------------------------------------------------------------*/
+
+#define DT_MPOL_MF_MOVE (1 << 1)
+
+/* xbind applies policy to the pages spanning [p, p + len). mbind works on whole pages,
+   so a page shared with a neighbouring region picks up the policy as well.
+*/
+static int xbind(void *p, size_t len, int policy, unsigned long nodemask) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p & ~(page - 1);
+    uintptr_t end = ALIGN_UP((uintptr_t)p + len, page);
+    unsigned long mask = policy == DT_NUMA_DEFAULT ? 0 : nodemask;
+    return syscall(SYS_mbind, start, end - start, policy,
+                   policy == DT_NUMA_DEFAULT ? NULL : &mask,
+                   policy == DT_NUMA_DEFAULT ? 0 : sizeof(mask) * 8 + 1,
+                   DT_MPOL_MF_MOVE) == 0;
+}
+
+static int lb_set_placement(lb_table_t *t, unsigned regions, int policy, unsigned long nodemask) {
+    int ok = 1;
+    if (regions & DT_REGION_KEYS)
+        ok &= xbind(lb_keys(t), (size_t)t->max_count * t->key_size, policy, nodemask);
+    if (regions & DT_REGION_VALUES)
+        ok &= xbind(lb_values(t), (size_t)t->max_count * t->value_size, policy, nodemask);
+    if (regions & DT_REGION_BITMAP) {
+        ok &= xbind(lb_bitmap(t), BITMAP_WORDS(t->max_count) * sizeof(uint64_t), policy, nodemask);
+        if (t->ready_off != t->bitmap_off)
+            ok &= xbind(lb_ready(t), BITMAP_WORDS(t->max_count) * sizeof(uint64_t), policy, nodemask);
+    }
+    return ok;
+}
+
+/* dt_set_placement sets the NUMA policy of the selected regions of both tables.
+   Pages that were already faulted in are migrated. Best called right after creation,
+   before the first insert touches the arrays. Returns 1 on success, 0 if any mbind failed.
+*/
+int dt_set_placement(dt_t *dt, unsigned regions, int policy, unsigned long nodemask) {
+    int ok = lb_set_placement(&dt->primary, regions, policy, nodemask);
+    ok &= lb_set_placement(&dt->secondary, regions, policy, nodemask);
+    return ok;
+}
+
+/* dt_current_node returns the NUMA node the calling thread runs on. The answer is cached
+   per thread and refreshed every 1024 calls, since threads rarely change sockets.
+*/
+static int dt_current_node(void) {
+    static _Thread_local unsigned node, calls;
+    if (calls++ % 1024 == 0) {
+        unsigned cpu;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+            node = 0;
+    }
+    return (int)node;
+}
+
+/* dt_replicated_create builds num_nodes replicas (at most DT_MAX_NODES), replica i
+   bound to node i. Returns NULL if a replica cannot be created or bound (e.g. node i
+   does not exist).
+*/
+dt_replicated_t *dt_replicated_create(const dt_config_t *config, int num_nodes) {
+    if (num_nodes < 1 || num_nodes > DT_MAX_NODES) return NULL;
+    dt_replicated_t *r = xmap(sizeof(dt_replicated_t));
+    if (!r) return NULL;
+    r->num_nodes = num_nodes;
+    for (int i = 0; i < num_nodes; i++) {
+        r->replica[i] = dt_create_ex(config);
+        if (!r->replica[i] || !dt_set_placement(r->replica[i], DT_REGION_ALL, DT_NUMA_BIND, 1UL << i)) {
+            dt_replicated_destroy(r);
+            return NULL;
+        }
+    }
+    return r;
+}
+
+void dt_replicated_destroy(dt_replicated_t *r) {
+    for (int i = 0; i < r->num_nodes; i++)
+        dt_destroy(r->replica[i]);
+    munmap(r, sizeof(dt_replicated_t));
+}
+
+/* dt_replicated_insert inserts into every replica. If one of them is full, the copies
+   already made are removed again so the replicas stay identical.
+*/
+int dt_replicated_insert(dt_replicated_t *r, const void *key, const void *value) {
+    for (int i = 0; i < r->num_nodes; i++) {
+        if (!dt_insert(r->replica[i], key, value)) {
+            while (i--)
+                dt_delete(r->replica[i], key);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int dt_replicated_lookup(dt_replicated_t *r, const void *key, void *value_out) {
+    return dt_lookup(r->replica[dt_current_node() % r->num_nodes], key, value_out);
+}
+
+int dt_replicated_delete(dt_replicated_t *r, const void *key) {
+    int found = 0;
+    for (int i = 0; i < r->num_nodes; i++)
+        found |= dt_delete(r->replica[i], key);
+    return found;
+}
+
+void dt_replicated_reset(dt_replicated_t *r) {
+    for (int i = 0; i < r->num_nodes; i++)
+        dt_reset(r->replica[i]);
+}
+
+/*-------------------------------------------------------------------------
+   Sharded Tables (dt_sharded_t)
+-------------------------------------------------------------------------*/
+
+/* dt_sharded_create builds 1 << shard_bits shards from config (at most DT_MAX_SHARD_BITS bits). */
+dt_sharded_t *dt_sharded_create(const dt_config_t *config, unsigned shard_bits) {
+    if (shard_bits > DT_MAX_SHARD_BITS) return NULL;
+    uint32_t num_shards = 1u << shard_bits;
+    size_t size = sizeof(dt_sharded_t) + num_shards * sizeof(dt_shard_t);
+    dt_sharded_t *s = xmap(size);
+    if (!s) return NULL;
+    s->shard_bits = shard_bits;
+    s->num_shards = num_shards;
+    s->key_size = config->key_size;
+    s->size = size;
+    dt_config_t cfg = *config;
+    cfg.num_workers = 0; // per-shard worker pools would multiply threads by the shard count
+    for (uint32_t i = 0; i < num_shards; i++) {
+        s->shards[i].dt = dt_create_ex(&cfg);
+        if (!s->shards[i].dt) {
+            dt_sharded_destroy(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+void dt_sharded_destroy(dt_sharded_t *s) {
+    for (uint32_t i = 0; i < s->num_shards; i++)
+        dt_destroy(s->shards[i].dt);
+    munmap(s, s->size);
+}
+
+/* dt_sharded_shard returns the shard owning key: the top shard_bits of a hash seeded
+   independently of the ones the shards use for bucket selection.
+*/
+uint32_t dt_sharded_shard(const dt_sharded_t *s, const void *key) {
+    if (!s->shard_bits) return 0;
+    return hash_key(key, s->key_size, SHARD_SEED) >> (32 - s->shard_bits);
+}
+
+static inline dt_shard_t *dt_shard_lock(dt_sharded_t *s, uint32_t shard) {
+    dt_shard_t *sh = &s->shards[shard];
+    if (!sh->dt->primary.locks_off) spin_lock(&sh->lock);
+    return sh;
+}
+
+static inline void dt_shard_unlock(dt_shard_t *sh) {
+    if (!sh->dt->primary.locks_off) spin_unlock(&sh->lock);
+}
+
+/* dt_sharded_insert inserts into the owning shard; the tiny pointer written to tp_out
+   (if non-NULL) carries the shard id.
+*/
+int dt_sharded_insert(dt_sharded_t *s, const void *key, const void *value, tiny_ptr_t *tp_out) {
+    uint32_t shard = dt_sharded_shard(s, key);
+    dt_shard_t *sh = dt_shard_lock(s, shard);
+    int ok = dt_insert_tp(sh->dt, key, value, tp_out);
+    dt_shard_unlock(sh);
+    if (tp_out)
+        tp_out->shard = (uint16_t)shard;
+    return ok;
+}
+
+int dt_sharded_lookup(dt_sharded_t *s, const void *key, void *value_out) {
+    dt_shard_t *sh = dt_shard_lock(s, dt_sharded_shard(s, key));
+    int found = dt_lookup(sh->dt, key, value_out);
+    dt_shard_unlock(sh);
+    return found;
+}
+
+int dt_sharded_delete(dt_sharded_t *s, const void *key) {
+    dt_shard_t *sh = dt_shard_lock(s, dt_sharded_shard(s, key));
+    int found = dt_delete(sh->dt, key);
+    dt_shard_unlock(sh);
+    return found;
+}
+
+/* dt_sharded_reset resets every shard in turn; like dt_reset it must not overlap other
+   operations on the same shards.
+*/
+void dt_sharded_reset(dt_sharded_t *s) {
+    for (uint32_t i = 0; i < s->num_shards; i++)
+        dt_reset(s->shards[i].dt);
+}
+
+/* dt_sharded_deref follows a tiny pointer from dt_sharded_insert to its value. The
+   returned pointer is only stable while the entry is not deleted (see dt_deref); once it
+   is, the slot may be handed to another key.
+*/
+void *dt_sharded_deref(dt_sharded_t *s, tiny_ptr_t tp) {
+    if (tp.shard >= s->num_shards) return NULL;
+    dt_shard_t *sh = dt_shard_lock(s, tp.shard);
+    void *value = dt_deref(sh->dt, tp);
+    dt_shard_unlock(sh);
+    return value;
+}
+
+/*-------------------------------------------------------------------------
+   Shared-Memory Tables
+-------------------------------------------------------------------------*/
+
+#define DT_MFD_CLOEXEC 0x1U
+
+/* dt_map_shared sizes the file behind fd for config, maps it MAP_SHARED and builds the
+   table in it. The file starts out zero-filled, just like xmap memory, so nothing beyond
+   the header needs initialising. Every array is addressed relative to the header, so the
+   mapping may land at a different address in each process. The magic is published last,
+   which is what attachers check for.
+*/
+static dt_t *dt_map_shared(int fd, const dt_config_t *config) {
+    dt_config_t cfg = *config;
+    cfg.flags |= DT_CONCURRENT;
+    size_t size = dt_layout(NULL, &cfg);
+    if (ftruncate(fd, (off_t)size) != 0) return NULL;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return NULL;
+    dt_t *dt = p;
+    dt_layout(dt, &cfg);
+    dt->size = size;
+    __atomic_store_n(&dt->magic, DT_MAGIC, __ATOMIC_RELEASE);
+    return dt;
+}
+
+/* dt_shm_create builds a table in a new POSIX shared-memory object called name (which
+   must not exist yet, see shm_open). Shared tables are always DT_CONCURRENT, and every
+   atomic they use works between processes, so any number of processes may insert, look
+   up and delete at once after attaching. Returns NULL on failure (errno is set).
+   dt_destroy unmaps the table in this process only; dt_shm_unlink removes the name.
+   A process that dies inside a read section (dt_read_begin) pins its reader slot, and
+   one that dies holding a bucket stripe (in dt_delete) wedges that stripe.
+*/
+dt_t *dt_shm_create(const char *name, const dt_config_t *config) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    dt_t *dt = dt_map_shared(fd, config);
+    close(fd);
+    if (!dt)
+        shm_unlink(name);
+    return dt;
+}
+
+/* dt_shm_attach maps the table another process created under name. */
+dt_t *dt_shm_attach(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    dt_t *dt = dt_fd_attach(fd);
+    close(fd);
+    return dt;
+}
+
+int dt_shm_unlink(const char *name) {
+    return shm_unlink(name) == 0;
+}
+
+/* dt_memfd_create is dt_shm_create for an anonymous memfd instead of a named object; the
+   descriptor is stored in *fd_out so it can be inherited or passed over a Unix socket to
+   the processes that dt_fd_attach it. The caller closes it when done handing it out.
+*/
+dt_t *dt_memfd_create(const char *name, const dt_config_t *config, int *fd_out) {
+    int fd = (int)syscall(SYS_memfd_create, name, DT_MFD_CLOEXEC);
+    if (fd < 0) return NULL;
+    dt_t *dt = dt_map_shared(fd, config);
+    if (!dt) {
+        close(fd);
+        return NULL;
+    }
+    *fd_out = fd;
+    return dt;
+}
+
+/* dt_fd_attach maps the shared table behind fd. Returns NULL if fd does not hold a
+   completely built table (yet).
+*/
+dt_t *dt_fd_attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(dt_t)) return NULL;
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return NULL;
+    dt_t *dt = p;
+    if (__atomic_load_n(&dt->magic, __ATOMIC_ACQUIRE) != DT_MAGIC || dt->size != (size_t)st.st_size) {
+        munmap(p, (size_t)st.st_size);
+        return NULL;
+    }
+    return dt;
 }
 
 #endif /* TP_DT_IMPLEMENTATION */